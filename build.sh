@@ -1 +1 @@
-emcc -Ideps/glad/include  src/main.cpp src/regl-cpp.cpp src/glfw-util.cpp  -O2 -std=c++14 -s TOTAL_MEMORY=33554432 -s USE_GLFW=3 -o htmlout/SingleFileOpenGLTex.html
+emcc -Ideps/glad/include  src/main.cpp src/regl-cpp.cpp src/glfw-util.cpp src/job-system.cpp src/mesh-optimizer.cpp  -O2 -std=c++14 -s TOTAL_MEMORY=33554432 -s USE_GLFW=3 -o htmlout/SingleFileOpenGLTex.html
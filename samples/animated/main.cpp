@@ -1,6 +1,8 @@
 #include "regl-cpp.hpp"
 
 #include "glfw-util.hpp"
+#include "mesh-optimizer.hpp"
+#include <cstddef>
 
 
 #define TINYGLTF_IMPLEMENTATION
@@ -123,6 +125,10 @@ void loadMesh(
 	}
 	tinygltf::Primitive gltfPrimtive = gltfMesh.primitives[0];
 
+	std::vector<float> positions;
+	std::vector<float> normals;
+	std::vector<float> texcoords;
+
 	if (gltfPrimtive.attributes.count("POSITION") == 0) {
 		printf("Primtivie lacks a position attribute\n");
 		exit(1);
@@ -210,13 +216,7 @@ void loadMesh(
 			posData.push_back(z);
 		}
 
-		*meshPosBuffer =
-			reglCpp::VertexBuffer()
-			.data(posData.data())
-			.length((unsigned int)posData.size() / 3)
-			.numComponents(3)
-			.name("mesh position buffer")
-			.finish();
+		positions = posData;
 
 		*numPoints = posData.size() / 3;
 	}
@@ -282,13 +282,7 @@ void loadMesh(
 			normalData.push_back(z);
 		}
 
-		*meshNormalBuffer =
-			reglCpp::VertexBuffer()
-			.data(normalData.data())
-			.length((unsigned int)normalData.size() / 3)
-			.numComponents(3)
-			.name("mesh normal buffer")
-			.finish();
+		normals = normalData;
 	}
 
 	{
@@ -341,13 +335,28 @@ void loadMesh(
 			normalData.push_back(y);
 		}
 
-		*meshTexcoordBuffer =
-			reglCpp::VertexBuffer()
-			.data(normalData.data())
-			.length((unsigned int)normalData.size() / 2)
-			.numComponents(2)
-			.name("mesh texcoord buffer")
-			.finish();
+		texcoords = normalData;
+	}
+
+	// the attributes are interleaved into a single buffer, with the normals packed into 10 bits per component, 
+	// and the texcoords as half floats. that makes a vertex 20 bytes, instead of the 32 bytes of only floats.
+	struct Vertex {
+		float mPosition[3];
+		unsigned int mNormal;
+		unsigned short mTexcoord[2];
+	};
+
+	std::vector<Vertex> vertices(positions.size() / 3);
+	{
+		for (size_t iVertex = 0; iVertex < vertices.size(); ++iVertex) {
+			Vertex& vertex = vertices[iVertex];
+			vertex.mPosition[0] = positions[iVertex * 3 + 0];
+			vertex.mPosition[1] = positions[iVertex * 3 + 1];
+			vertex.mPosition[2] = positions[iVertex * 3 + 2];
+			vertex.mNormal = reglCpp::packInt10_10_10_2(normals[iVertex * 3 + 0], normals[iVertex * 3 + 1], normals[iVertex * 3 + 2], 0.0f);
+			vertex.mTexcoord[0] = reglCpp::halfFloat(texcoords[iVertex * 2 + 0]);
+			vertex.mTexcoord[1] = reglCpp::halfFloat(texcoords[iVertex * 2 + 1]);
+		}
 	}
 
 	
@@ -375,7 +384,8 @@ void loadMesh(
 		const unsigned short imax = gltfIndexAccesor.maxValues[0];
 		
 
-		std::vector<unsigned int> indexData;
+		// kept as 16 bits, like in the file.
+		std::vector<unsigned short> indexData;
 		
 		for (int iElem = 0; iElem < gltfIndexAccesor.count; ++iElem) {
 			unsigned short index = bytesToUnsignedShort(
@@ -388,6 +398,43 @@ void loadMesh(
 			indexData.push_back(index);
 		}
 
+		// the triangles are in the order they were authored in, so they are reordered for the vertex cache and overdraw,
+		// and the vertices for fetching.
+		reglCpp::MeshOptimizationReport report = reglCpp::optimizeMesh(
+			indexData, vertices.data(), vertices.size(), sizeof(Vertex), offsetof(Vertex, mPosition));
+		report.print("mesh");
+		vertices.resize(report.mNumVertices);
+
+		*meshPosBuffer =
+			reglCpp::VertexBuffer()
+			.data(vertices.data())
+			.length((unsigned int)vertices.size())
+			.numComponents(3)
+			.stride(sizeof(Vertex))
+			.name("mesh vertex buffer")
+			.finish();
+
+		*meshNormalBuffer =
+			reglCpp::VertexBuffer()
+			.source(meshPosBuffer)
+			.numComponents(4)
+			.type("int_10_10_10_2")
+			.normalized(true)
+			.stride(sizeof(Vertex))
+			.offset(offsetof(Vertex, mNormal))
+			.name("mesh normal buffer")
+			.finish();
+
+		*meshTexcoordBuffer =
+			reglCpp::VertexBuffer()
+			.source(meshPosBuffer)
+			.numComponents(2)
+			.type("half")
+			.stride(sizeof(Vertex))
+			.offset(offsetof(Vertex, mTexcoord))
+			.name("mesh texcoord buffer")
+			.finish();
+
 		*meshIndexBuffer =
 			reglCpp::IndexBuffer()
 			.data(indexData.data())
@@ -541,25 +588,25 @@ void demo() {
 
 		mat4 viewProjectionMatrix = viewMatrix * projectionMatrix;
 
-		std::array<std::array<float, 4>, 4> view{
-			{
-			{ 1.0f, 2.0f, 1.0f, 5.0f },
-			{ 1.0f, 2.0f, 1.0f, 5.0f },
-			{ 1.0f, 2.0f, 1.0f, 5.0f },
-			{ 1.0f, 2.0f, 1.0f, 5.0f },
-			}
-		};
-		std::vector<Uniform> lol;
+		static const Symbol uViewProjectionMatrix("uViewProjectionMatrix");
+		static const Symbol uModelMatrix("uModelMatrix");
+		static const Symbol uTex("uTex");
+		static const Symbol aPosition("aPosition");
+		static const Symbol aNormal("aNormal");
+		static const Symbol aUv("aUv");
 
-		Command clearCmd = Command()
-			.clearColor({ 0.2f, 0.2f, 0.2f, 1.0f })
-			.clearDepth(1.0f)
-			.viewport(0, 0, getFramebufferWidth(), getFramebufferHeight());
+		// the commands are built again every frame, from the pool of the context, so this doesn't allocate.
+		reglCpp::context.frame([&]() {
+
+			Command& clearCmd = context.frameCommand()
+				.clearColor({ 0.2f, 0.2f, 0.2f, 1.0f })
+				.clearDepth(1.0f)
+				.viewport(0, 0, getFramebufferWidth(), getFramebufferHeight());
 		
-		Command baseCmd = Command()
-			.viewport(0, 0, getFramebufferWidth(), getFramebufferHeight())
-			.depthTest(true)
-			.vert(R"V0G0N(  
+			Command& baseCmd = context.frameCommand()
+				.viewport(0, 0, getFramebufferWidth(), getFramebufferHeight())
+				.depthTest(true)
+				.vert(R"V0G0N(  
 precision highp float;
 
 attribute vec3 aPosition;
@@ -580,11 +627,9 @@ void main()
 }
 
 				)V0G0N")
-			.uniforms({
-				{ "uViewProjectionMatrix", mat4::toArr(viewProjectionMatrix) },
-				});
-		
-		reglCpp::context.frame([&]() {
+				.uniforms({
+					{ uViewProjectionMatrix, mat4::toArr(viewProjectionMatrix) },
+					});
 			
 			reglCpp::context.submit(clearCmd);
 			
@@ -594,7 +639,7 @@ void main()
 					mat4 modelMatrix;
 					//modelMatrix.m[3][0] = -0.5f;
 
-					Command pointsCmd = Command()
+					Command& pointsCmd = context.frameCommand()
 
 						.frag(R"V0G0N( 
 precision highp float;
@@ -611,9 +656,9 @@ void main()
 }
 				)V0G0N")
 						.attributes({
-							{ "aPosition", &meshPosBuffer },
-							{ "aNormal",& meshNormalBuffer },
-							{ "aUv",& meshTexcoordBuffer }
+							{ aPosition, &meshPosBuffer },
+							{ aNormal, &meshNormalBuffer },
+							{ aUv, &meshTexcoordBuffer }
 							} )
 
 						.indices(&meshIndexBuffer)
@@ -622,8 +667,8 @@ void main()
 
 						.primitive("triangles")
 						.uniforms({
-							{ "uModelMatrix", mat4::toArr(modelMatrix) },
-							{ "uTex", &meshTexture }
+							{ uModelMatrix, mat4::toArr(modelMatrix) },
+							{ uTex, &meshTexture }
 							});
 
 					reglCpp::context.submit(pointsCmd);
@@ -636,9 +681,9 @@ void main()
 	});
 	
 
-	meshPosBuffer.dispose();
 	meshNormalBuffer.dispose();
 	meshTexcoordBuffer.dispose();
+	meshPosBuffer.dispose();
 	meshIndexBuffer.dispose();
 	meshTexture.dispose();
 
@@ -0,0 +1,441 @@
+#include "regl-cpp.hpp"
+#include "job-system.hpp"
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+/*
+Measures the cost of entering and leaving scopes, in a tree of nested scopes where every scope has two children.
+The same tree is walked three times: with the scopes bodies wrapped in std::function, as in older versions of the
+library, with lambdas passed to the templated submit(), and with context.scope() objects.
+It is then walked twice more with Commands that are built in every scope, first as new Commands, and then
+with context.frameCommand() and props from context.frameAllocate(), which shouldn't allocate at all after the first frame.
+The leaves of those walks don't draw anything, so only the scopes themselves are measured.
+Finally every leaf submits a draw with props, which measures the cost of resolving and compiling a submit inside deeply 
+nested scopes. That needs a GL context, for which a hidden window is created. The draws are recorded into the command 
+buffer, which is cleared instead of flushed, so that the time is not spent in the driver.
+Then compiled draws are recorded on the threads of a JobSystem into the recorders of the context, which are 
+flushed at the end of every frame, so that the time includes executing them. They are recorded once more with
+batching enabled, which merges them into instanced draws by turning the offset uniform into an attribute, 
+and finally submitted as a single instanced draw, with the offsets in a per instance buffer, for comparison.
+The same draw is submitted again with offsets that move every frame, written into a streaming buffer.
+The programs are stored in the program binary cache, in the directory given as the first argument, or the current
+one, so the next run loads them instead of compiling them. They are precompiled before the first frame, which 
+draws with a fallback program until they are ready.
+*/
+
+// the workers allocate too, if anything does while they record.
+static std::atomic<size_t> numAllocations(0);
+
+void* operator new(size_t size) {
+	++numAllocations;
+	void* p = malloc(size);
+	if (p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+using namespace reglCpp;
+
+const int TREE_DEPTH = 16;
+const int NUM_FRAMES = 20;
+
+void walkFunction(const std::vector<Command>& commands, int depth, int& leaves) {
+	if (depth == (int)commands.size()) {
+		++leaves;
+		return;
+	}
+
+	for (int iChild = 0; iChild < 2; ++iChild) {
+		std::function<void()> fn = [&commands, depth, &leaves]() {
+			walkFunction(commands, depth + 1, leaves);
+		};
+		context.submit(commands[depth], fn);
+	}
+}
+
+void walkTemplate(const std::vector<Command>& commands, int depth, int& leaves) {
+	if (depth == (int)commands.size()) {
+		++leaves;
+		return;
+	}
+
+	for (int iChild = 0; iChild < 2; ++iChild) {
+		context.submit(commands[depth], [&commands, depth, &leaves]() {
+			walkTemplate(commands, depth + 1, leaves);
+		});
+	}
+}
+
+void walkScope(const std::vector<Command>& commands, int depth, int& leaves) {
+	if (depth == (int)commands.size()) {
+		++leaves;
+		return;
+	}
+
+	for (int iChild = 0; iChild < 2; ++iChild) {
+		auto scope = context.scope(commands[depth]);
+		walkScope(commands, depth + 1, leaves);
+	}
+}
+
+struct ScopeProps {
+	std::array<float, 4> mColor;
+};
+
+const char* vertexShader = R"V0G0N(
+attribute vec3 aPosition;
+void main() {
+	gl_Position = vec4(aPosition, 1.0);
+}
+)V0G0N";
+
+void walkNewCommands(const std::vector<Command>& commands, int depth, int& leaves) {
+	if (depth == (int)commands.size()) {
+		++leaves;
+		return;
+	}
+
+	for (int iChild = 0; iChild < 2; ++iChild) {
+		ScopeProps props;
+		props.mColor = { (float)depth, 0.0f, 0.0f, 1.0f };
+
+		Command command = Command()
+			.vert(std::string(vertexShader))
+			.uniforms(std::vector<Uniform>{ { "uColor", UniformValue::prop(&ScopeProps::mColor) } });
+
+		auto scope = context.scope(command, &props);
+		walkNewCommands(commands, depth + 1, leaves);
+	}
+}
+
+void walkFrameCommands(const std::vector<Command>& commands, int depth, int& leaves) {
+	if (depth == (int)commands.size()) {
+		++leaves;
+		return;
+	}
+
+	static const Symbol uColor("uColor");
+
+	for (int iChild = 0; iChild < 2; ++iChild) {
+		ScopeProps* props = context.frameAllocate<ScopeProps>();
+		props->mColor = { (float)depth, 0.0f, 0.0f, 1.0f };
+
+		Command& command = context.frameCommand()
+			.vert(vertexShader)
+			.uniforms({ { uColor, UniformValue::prop(&ScopeProps::mColor) } });
+
+		auto scope = context.scope(command, props);
+		walkFrameCommands(commands, depth + 1, leaves);
+	}
+}
+
+struct LeafProps {
+	std::array<float, 4> mColor;
+};
+
+const char* leafFragmentShader = R"V0G0N(
+precision highp float;
+uniform vec4 uColor;
+void main() {
+	gl_FragColor = uColor;
+}
+)V0G0N";
+
+const Command* leafCommand = nullptr;
+
+void walkSubmit(const std::vector<Command>& commands, int depth, int& leaves) {
+	if (depth == (int)commands.size()) {
+		LeafProps props;
+		props.mColor = { (float)leaves, 0.0f, 0.0f, 1.0f };
+		context.submit(*leafCommand, &props);
+
+		++leaves;
+		return;
+	}
+
+	for (int iChild = 0; iChild < 2; ++iChild) {
+		auto scope = context.scope(commands[depth]);
+		walkSubmit(commands, depth + 1, leaves);
+	}
+}
+
+void walkSubmitRecorded(const std::vector<Command>& commands, int depth, int& leaves) {
+	CommandBuffer& buffer = context.record();
+	walkSubmit(commands, depth, leaves);
+	buffer.clear();
+}
+
+void measure(const char* name, const std::vector<Command>& commands, void (*walk)(const std::vector<Command>&, int, int&), 
+	size_t numPerFrame, const char* per) {
+	int leaves = 0;
+
+	// the first frame grows the state stack and the frame arena, so it is not measured.
+	context.frame([&]() { walk(commands, 0, leaves); });
+
+	size_t allocationsBefore = numAllocations;
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for (int iFrame = 0; iFrame < NUM_FRAMES; ++iFrame) {
+		context.frame([&]() { walk(commands, 0, leaves); });
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+
+	printf("%-16s %8.3f ms per frame, %6.2f ns per %s, %zu allocations\n",
+		name,
+		seconds * 1000.0 / NUM_FRAMES,
+		seconds * 1e9 / (numPerFrame * NUM_FRAMES),
+		per,
+		numAllocations - allocationsBefore);
+}
+
+const int NUM_RECORDED_DRAWS = 1 << 14;
+
+const char* offsetVertexShader = R"V0G0N(
+attribute vec3 aPosition;
+uniform vec2 uOffset;
+void main() {
+	gl_Position = vec4(aPosition.xy * 0.01 + uOffset, aPosition.z, 1.0);
+}
+)V0G0N";
+
+const char* instancedVertexShader = R"V0G0N(
+attribute vec3 aPosition;
+attribute vec2 aOffset;
+void main() {
+	gl_Position = vec4(aPosition.xy * 0.01 + aOffset, aPosition.z, 1.0);
+}
+)V0G0N";
+
+const char* whiteFragmentShader = R"V0G0N(
+precision highp float;
+void main() {
+	gl_FragColor = vec4(1.0);
+}
+)V0G0N";
+
+// every draw is recorded with its own offset, by the thread that gets its chunk of the draws.
+void recordDraws(JobSystem& jobs, const DrawCall& drawCall, const std::vector<std::vector<Uniform>>& offsets) {
+	jobs.parallelFor((int)offsets.size(), 256, [&drawCall, &offsets](int begin, int end, int threadIndex) {
+		CommandBuffer& recorder = context.recorder(threadIndex);
+		for (int iDraw = begin; iDraw < end; ++iDraw) {
+			recorder.draw(drawCall, offsets[iDraw]);
+		}
+	});
+}
+
+// measures frames that do the same thing every frame.
+template<typename Fn>
+void measureFrames(const char* name, size_t numPerFrame, const char* per, const Fn& fn) {
+	// the first frame grows whatever the frame needs, so it is not measured.
+	context.frame(fn);
+
+	size_t allocationsBefore = numAllocations;
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for (int iFrame = 0; iFrame < NUM_FRAMES; ++iFrame) {
+		context.frame(fn);
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+
+	printf("%-16s %8.3f ms per frame, %6.2f ns per %s, %zu allocations\n",
+		name,
+		seconds * 1000.0 / NUM_FRAMES,
+		seconds * 1e9 / (numPerFrame * NUM_FRAMES),
+		per,
+		numAllocations - allocationsBefore);
+}
+
+bool createHiddenWindow() {
+	if (!glfwInit()) {
+		return false;
+	}
+
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+
+	GLFWwindow* window = glfwCreateWindow(64, 64, "scope benchmark", NULL, NULL);
+	if (!window) {
+		glfwTerminate();
+		return false;
+	}
+	glfwMakeContextCurrent(window);
+	gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	std::vector<Command> commands;
+	for (int iDepth = 0; iDepth < TREE_DEPTH; ++iDepth) {
+		commands.push_back(Command().depthTest(iDepth % 2 == 0));
+	}
+
+	printf("%d frames of a scope tree of depth %d, with %d leaves\n", NUM_FRAMES, TREE_DEPTH, 1 << TREE_DEPTH);
+
+	size_t numScopes = (size_t(1) << (TREE_DEPTH + 1)) - 2;
+	measure("std::function", commands, walkFunction, numScopes, "scope");
+	measure("template", commands, walkTemplate, numScopes, "scope");
+	measure("scope()", commands, walkScope, numScopes, "scope");
+	measure("new Command", commands, walkNewCommands, numScopes, "scope");
+	measure("frameCommand()", commands, walkFrameCommands, numScopes, "scope");
+
+	printf("frame arena: %zu bytes in the last frame\n", context.getStats().mFrameArenaBytes);
+
+	if (!createHiddenWindow()) {
+		printf("no GL context could be created, so the submits are not measured\n");
+		return 0;
+	}
+
+	context.programBinaryCache(argc > 1 ? argv[1] : ".");
+
+	// the programs compile in parallel, if the driver can, while the first frames draw with the fallback.
+	context.fallbackProgram(vertexShader, whiteFragmentShader);
+	context.precompile({ 
+		{ vertexShader, leafFragmentShader }, 
+		{ offsetVertexShader, whiteFragmentShader }, 
+		{ instancedVertexShader, whiteFragmentShader } });
+
+	std::vector<float> positions = { 0.0f, 0.0f, 0.0f,  1.0f, 0.0f, 0.0f,  0.0f, 1.0f, 0.0f };
+	VertexBuffer positionBuffer = VertexBuffer()
+		.data(positions.data())
+		.length(3)
+		.numComponents(3)
+		.name("leaf position buffer")
+		.finish();
+
+	Command leaf = Command()
+		.vert(vertexShader)
+		.frag(leafFragmentShader)
+		.attributes({ { "aPosition", &positionBuffer } })
+		.uniforms({ { "uColor", UniformValue::prop(&LeafProps::mColor) } })
+		.count(3);
+	leafCommand = &leaf;
+
+	// the viewport is set by the root of the tree, so every submit resolves state from all the scopes above it.
+	commands[0].viewport(0, 0, 64, 64);
+
+	int warmupFrames = 0;
+	while (!context.programsReady()) {
+		context.frame([&]() {
+			auto scope = context.scope(commands[0]);
+			LeafProps props;
+			props.mColor = { 1.0f, 1.0f, 1.0f, 1.0f };
+			context.submit(leaf, &props);
+		});
+		++warmupFrames;
+	}
+	printf("precompiled programs ready after %d frames, %d draws used the fallback program\n", 
+		warmupFrames, context.getStats().mProgramFallbacks);
+
+	measure("submit()", commands, walkSubmitRecorded, size_t(1) << TREE_DEPTH, "submit");
+
+	JobSystem jobs;
+	context.createRecorders(jobs.numThreads());
+
+	// the names are interned here, so that the workers never have to lock the symbol table.
+	static const Symbol uOffset("uOffset");
+	std::vector<std::vector<Uniform>> offsets(NUM_RECORDED_DRAWS);
+	for (int iDraw = 0; iDraw < NUM_RECORDED_DRAWS; ++iDraw) {
+		offsets[iDraw] = { { uOffset, UniformValue((float)(iDraw % 128) / 64.0f - 1.0f, (float)(iDraw / 128) / 64.0f - 1.0f) } };
+	}
+
+	DrawCall offsetDraw = context.compile(Command()
+		.viewport(0, 0, 64, 64)
+		.vert(offsetVertexShader)
+		.frag(whiteFragmentShader)
+		.attributes({ { "aPosition", &positionBuffer } })
+		.uniforms({ { uOffset, UniformValue(0.0f, 0.0f) } })
+		.count(3));
+
+	printf("%d draws recorded on %d threads\n", NUM_RECORDED_DRAWS, jobs.numThreads());
+	measureFrames("recorder()", offsets.size(), "draw", [&]() { recordDraws(jobs, offsetDraw, offsets); });
+
+	context.enableBatching({ uOffset });
+	int drawsBatched = context.getStats().mDrawsBatched;
+	measureFrames("batched", offsets.size(), "draw", [&]() { recordDraws(jobs, offsetDraw, offsets); });
+	context.disableBatching();
+	printf("batching merged %d of %d draws\n", context.getStats().mDrawsBatched - drawsBatched, NUM_RECORDED_DRAWS * (NUM_FRAMES + 1));
+
+	std::vector<float> offsetData;
+	for (const std::vector<Uniform>& offset : offsets) {
+		offsetData.push_back(offset[0].mValue.mFloatVec2[0]);
+		offsetData.push_back(offset[0].mValue.mFloatVec2[1]);
+	}
+	VertexBuffer offsetBuffer = VertexBuffer()
+		.data(offsetData.data())
+		.length(NUM_RECORDED_DRAWS)
+		.numComponents(2)
+		.divisor(1)
+		.name("instance offset buffer")
+		.finish();
+
+	Command instanced = Command()
+		.viewport(0, 0, 64, 64)
+		.vert(instancedVertexShader)
+		.frag(whiteFragmentShader)
+		.attributes({ { "aPosition", &positionBuffer }, { "aOffset", &offsetBuffer } })
+		.count(3)
+		.instances(NUM_RECORDED_DRAWS);
+	measureFrames("instances()", offsets.size(), "instance", [&]() { context.submit(instanced); });
+
+	// the offsets move every frame, so they are written into the next region of a streaming buffer.
+	VertexBuffer streamingBuffer = VertexBuffer()
+		.data(offsetData.data())
+		.length(NUM_RECORDED_DRAWS)
+		.numComponents(2)
+		.divisor(1)
+		.streaming(true)
+		.name("streaming offset buffer")
+		.finish();
+
+	Command streamed = Command()
+		.viewport(0, 0, 64, 64)
+		.vert(instancedVertexShader)
+		.frag(whiteFragmentShader)
+		.attributes({ { "aPosition", &positionBuffer }, { "aOffset", &streamingBuffer } })
+		.count(3)
+		.instances(NUM_RECORDED_DRAWS);
+	auto streamOffsets = [&]() {
+		for (float& offset : offsetData) {
+			offset += 0.001f;
+		}
+		streamingBuffer.update(0, offsetData.data(), (int)(offsetData.size() * sizeof(float)));
+		context.submit(streamed);
+	};
+	// every region gets its own vertex array the first time it is drawn, which is not measured either.
+	for (int iRegion = 1; iRegion < VertexBuffer::NUM_REGIONS; ++iRegion) {
+		context.frame(streamOffsets);
+	}
+	measureFrames("streaming", offsets.size(), "instance", streamOffsets);
+
+	const reglCppContext::Stats& stats = context.getStats();
+	printf("streaming updates waited for the GPU %d times\n", stats.mStreamingWaits);
+	printf("program binary cache: %d programs loaded, %d compiled, %.2f ms saved\n",
+		stats.mProgramBinaryHits, stats.mProgramBinaryMisses, stats.mProgramBinaryTimeSaved * 1000.0);
+
+	streamingBuffer.dispose();
+	offsetBuffer.dispose();
+	positionBuffer.dispose();
+	context.dispose();
+	glfwTerminate();
+
+	return 0;
+}
@@ -58,6 +58,11 @@ void demo() {
 	reglCpp::VertexBuffer cubeUvBuffer;
 	reglCpp::IndexBuffer cubeIndexBuffer;
 
+	// all the vertex buffers of the cube are ranges of the same GL buffers.
+	// the indices have a pool of their own, since WebGL doesn't allow index and vertex data in the same GL buffer.
+	reglCpp::BufferPool meshPool = reglCpp::BufferPool().arenaSize(64 * 1024);
+	reglCpp::BufferPool indexPool = reglCpp::BufferPool().arenaSize(4 * 1024);
+
 	camera = Camera(vec3(-0.277534f, 0.885269f, 2.221981f), vec3(-0.008268f, -0.841857f, -0.539637f));
 
 	std::vector<float> posData;
@@ -77,6 +82,7 @@ void demo() {
 		.length((unsigned int)posData.size() / 3)
 		.numComponents(3)
 		.name("cube normal buffer")
+		.pool(&meshPool)
 		.finish();
 
 	cubeNormalBuffer =
@@ -85,6 +91,7 @@ void demo() {
 		.length((unsigned int)normalData.size() / 3)
 		.numComponents(3)
 		.name("cube normal buffer")
+		.pool(&meshPool)
 		.finish();
 	
 	cubeUvBuffer =
@@ -93,6 +100,7 @@ void demo() {
 		.length((unsigned int)uvData.size() / 2)
 		.numComponents(2)
 		.name("cube uv buffer")
+		.pool(&meshPool)
 		.finish();
 
 	cubeIndexBuffer =
@@ -100,6 +108,7 @@ void demo() {
 		.data(indexData.data())
 		.length((unsigned int)indexData.size() / 1)
 		.name("cube index buffer")
+		.pool(&indexPool)
 		.finish();
 
 	reglCpp::Texture2D texture;
@@ -122,38 +131,24 @@ void demo() {
 		.name("cube index buffer")
 		.finish();
 	
-	startRenderLoop([&]() {
+	using namespace reglCpp;
 
-		using namespace reglCpp;
-
-		float zNear = 0.1f;
-		float zFar = 8000.0f;
-		float ratio = (float)(getFramebufferWidth()) / (float)getFramebufferHeight();
-		mat4 projectionMatrix = mat4::perspective(0.872665f * 0.5f, (float)(getFramebufferWidth()) / (float)getFramebufferHeight(), zNear, zFar);
+	// everything that changes between frames is read from these, so the commands are only created once.
+	struct FrameProps {
+		std::array<std::array<float, 4>, 4> mViewProjectionMatrix;
+	};
 
-		mat4 viewMatrix = camera.GetViewMatrix();
+	struct CubeProps {
+		std::array<std::array<float, 4>, 4> mModelMatrix;
+	};
 
-		mat4 viewProjectionMatrix = viewMatrix * projectionMatrix;
-
-		std::array<std::array<float, 4>, 4> view{
-			{
-			{ 1.0f, 2.0f, 1.0f, 5.0f },
-			{ 1.0f, 2.0f, 1.0f, 5.0f },
-			{ 1.0f, 2.0f, 1.0f, 5.0f },
-			{ 1.0f, 2.0f, 1.0f, 5.0f },
-			}
-		};
-		std::vector<Uniform> lol;
-
-		Command clearCmd = Command()
-			.clearColor({ 0.2f, 0.2f, 0.2f, 1.0f })
-			.clearDepth(1.0f)
-			.viewport(0, 0, getFramebufferWidth(), getFramebufferHeight());
-		
-		Command baseCmd = Command()
-			.viewport(0, 0, getFramebufferWidth(), getFramebufferHeight())
-			.depthTest(true)
-			.vert(R"V0G0N(  
+	Command clearCmd = Command()
+		.clearColor({ 0.2f, 0.2f, 0.2f, 1.0f })
+		.clearDepth(1.0f);
+	
+	Command baseCmd = Command()
+		.depthTest(true)
+		.vert(R"V0G0N(  
 precision highp float;
 
 attribute vec3 aPosition;
@@ -175,8 +170,8 @@ void main()
     fsPos = (uModelMatrix * vec4(aPosition, 1.0)).xyz;
 }
 
-				)V0G0N")
-			.frag(R"V0G0N( 
+			)V0G0N")
+		.frag(R"V0G0N( 
 
 precision highp float;
  
@@ -192,45 +187,68 @@ void main()
     gl_FragColor = vec4(c.xyz, 1.0);
 }
 
-				)V0G0N")
-			.uniforms({
-				{ "uViewProjectionMatrix", mat4::toArr(viewProjectionMatrix) },
-				});
-		
+			)V0G0N")
+		.uniforms({
+			{ "uViewProjectionMatrix", UniformValue::prop(&FrameProps::mViewProjectionMatrix) },
+			});
+
+	Command cubeCmd = Command()
+		.attributes({
+			{ "aPosition", &cubePosBuffer },
+			{ "aUv", &cubeUvBuffer },
+
+			{ "aNormal", &cubeNormalBuffer } })
+		.indices(&cubeIndexBuffer)
+		.count((int)indexData.size())
+		.uniforms({
+			{ "uModelMatrix", UniformValue::prop(&CubeProps::mModelMatrix) },
+			{ "uTex", &texture },
+			});
+
+	startRenderLoop([&]() {
+
+		float zNear = 0.1f;
+		float zFar = 8000.0f;
+		mat4 projectionMatrix = mat4::perspective(0.872665f * 0.5f, (float)(getFramebufferWidth()) / (float)getFramebufferHeight(), zNear, zFar);
+
+		mat4 viewMatrix = camera.GetViewMatrix();
+
+		FrameProps frameProps;
+		frameProps.mViewProjectionMatrix = mat4::toArr(viewMatrix * projectionMatrix);
+
+		// the window may be resized, so the viewport is the one command still made per frame.
+		Command viewportCmd = Command()
+			.viewport(0, 0, getFramebufferWidth(), getFramebufferHeight());
+
 		reglCpp::context.frame([&]() {
-			
-			reglCpp::context.submit(clearCmd);
-			
-			reglCpp::context.submit(baseCmd, [&]() {
-			
-				{
-					mat4 modelMatrix;
-					modelMatrix.m[3][0] = -0.5f;
-
-					Command triCmd = Command()
-						.attributes({
-							{ "aPosition", &cubePosBuffer },
-							{ "aUv", &cubeUvBuffer },
-
-							{ "aNormal", &cubeNormalBuffer } })
-						.indices(&cubeIndexBuffer)
-						.count((int)indexData.size())
-						.uniforms({
-							{ "uModelMatrix", mat4::toArr(modelMatrix) },
-							{ "uTex", &texture },
-							});
-
-					reglCpp::context.submit(triCmd);
-				}
-
-			});	
+			reglCpp::context.submit(viewportCmd, [&]() {
+				
+				reglCpp::context.submit(clearCmd);
+				
+				reglCpp::context.submit(baseCmd, &frameProps, [&]() {
+				
+					{
+						mat4 modelMatrix;
+						modelMatrix.m[3][0] = -0.5f;
+
+						CubeProps cubeProps;
+						cubeProps.mModelMatrix = mat4::toArr(modelMatrix);
+
+						reglCpp::context.submit(cubeCmd, &cubeProps);
+					}
+
+				});	
+			});
 		});
 	});
 	
 
 	cubeNormalBuffer.dispose();
 	cubePosBuffer.dispose();
+	cubeUvBuffer.dispose();
 	cubeIndexBuffer.dispose();
+	meshPool.dispose();
+	indexPool.dispose();
 	
 	reglCpp::context.dispose();
 }
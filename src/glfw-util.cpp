@@ -185,7 +185,8 @@ void initGlfw(const std::function<void()>& fn) {
 	exit(EXIT_SUCCESS);
 }
 
-static std::function<void()> frameFn;
+static void (*frameFn)(const void* data);
+static const void* frameData;
 
 static float frameStartTime;
 static float frameEndTime;
@@ -194,7 +195,7 @@ void doFrame() {
 	glfwPollEvents();
 	HandleInput();
 
-	frameFn();
+	frameFn(frameData);
 
 	glfwSwapBuffers(window);
 
@@ -212,13 +213,14 @@ void doFrame() {
 	}
 }
 
-void startRenderLoop(const std::function<void()>& fn) {
+void startRenderLoop(void (*fn)(const void* data), const void* data) {
 
 	frameStartTime = 0;
 	frameEndTime = 0;
 	frameStartTime = (float)glfwGetTime();
 
 	frameFn = fn;
+	frameData = data;
 	
 #ifdef EMSCRIPTEN
 	emscripten_set_main_loop(doFrame, 0, 1);
@@ -53,4 +53,17 @@ int getFramebufferHeight();
 extern Camera camera;
 
 void initGlfw(const std::function<void()>& fn);
-void startRenderLoop(const std::function<void()>& fn);
+// calls 'fn(data)' once per frame, until the window is closed.
+void startRenderLoop(void (*fn)(const void* data), const void* data);
+
+// 'fn' is called through a plain function pointer instead of being stored in a std::function.
+template<typename Fn>
+void startRenderLoop(const Fn& fn) {
+#ifdef EMSCRIPTEN
+	// the stack is unwound when the emscripten main loop starts, so 'fn' has to outlive this call.
+	const Fn* frameFn = new Fn(fn);
+#else
+	const Fn* frameFn = &fn;
+#endif
+	startRenderLoop([](const void* data) { (*(const Fn*)data)(); }, frameFn);
+}
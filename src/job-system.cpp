@@ -0,0 +1,163 @@
+#include "job-system.hpp"
+
+namespace reglCpp {
+
+// the job system that the current thread belongs to, and its index in it.
+static thread_local const JobSystem* currentJobSystem = nullptr;
+static thread_local int currentIndex = -1;
+
+JobSystem::JobSystem(int numWorkers) : queuedJobs(0), quit(false), nextQueue(0) {
+	if (numWorkers < 0) {
+		numWorkers = (int)std::thread::hardware_concurrency() - 1;
+		if (numWorkers < 0) {
+			numWorkers = 0;
+		}
+	}
+
+	for (int iQueue = 0; iQueue < numWorkers + 1; ++iQueue) {
+		queues.push_back(std::unique_ptr<Queue>(new Queue()));
+	}
+
+	currentJobSystem = this;
+	currentIndex = 0;
+
+	for (int iWorker = 0; iWorker < numWorkers; ++iWorker) {
+		workers.push_back(std::thread(&JobSystem::workerLoop, this, iWorker + 1));
+	}
+}
+
+JobSystem::~JobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		quit = true;
+	}
+	wakeCondition.notify_all();
+
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+
+	if (currentJobSystem == this) {
+		currentJobSystem = nullptr;
+		currentIndex = -1;
+	}
+}
+
+int JobSystem::currentThreadIndex() const {
+	return currentJobSystem == this ? currentIndex : -1;
+}
+
+void JobSystem::run(const Job& job) {
+	int threadIndex = currentThreadIndex();
+	if (threadIndex == -1) {
+		threadIndex = (int)(nextQueue++ % queues.size());
+	}
+
+	++*job.mCounter;
+	{
+		Queue& queue = *queues[threadIndex];
+		std::lock_guard<std::mutex> lock(queue.mMutex);
+		if (queue.mNumJobs == queue.mJobs.size()) {
+			// unwrap the ring into a larger one.
+			std::vector<Job> jobs(queue.mJobs.empty() ? 64 : queue.mJobs.size() * 2);
+			for (size_t iJob = 0; iJob < queue.mNumJobs; ++iJob) {
+				jobs[iJob] = queue.mJobs[(queue.mFirst + iJob) % queue.mJobs.size()];
+			}
+			queue.mJobs.swap(jobs);
+			queue.mFirst = 0;
+		}
+		queue.mJobs[(queue.mFirst + queue.mNumJobs) % queue.mJobs.size()] = job;
+		++queue.mNumJobs;
+	}
+
+	// the sleeping threads check queuedJobs while holding sleepMutex, so taking it here makes sure that
+	// none of them can miss the notification.
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		++queuedJobs;
+	}
+	wakeCondition.notify_one();
+	// a thread in wait() can run the job too.
+	waitCondition.notify_one();
+}
+
+bool JobSystem::popOrSteal(int threadIndex, Job& job) {
+	// newest job of our own queue first, since its data is most likely still in the cache.
+	{
+		Queue& queue = *queues[threadIndex];
+		std::lock_guard<std::mutex> lock(queue.mMutex);
+		if (queue.mNumJobs != 0) {
+			--queue.mNumJobs;
+			job = queue.mJobs[(queue.mFirst + queue.mNumJobs) % queue.mJobs.size()];
+			--queuedJobs;
+			return true;
+		}
+	}
+
+	// then the oldest job of the other queues.
+	for (size_t iOffset = 1; iOffset < queues.size(); ++iOffset) {
+		Queue& queue = *queues[(threadIndex + iOffset) % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mMutex);
+		if (queue.mNumJobs != 0) {
+			job = queue.mJobs[queue.mFirst];
+			queue.mFirst = (queue.mFirst + 1) % queue.mJobs.size();
+			--queue.mNumJobs;
+			--queuedJobs;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void JobSystem::execute(const Job& job, int threadIndex) {
+	job.mFunction(job.mData, job.mBegin, job.mEnd, threadIndex);
+
+	// the waiting threads check their counter while holding sleepMutex, like the sleeping workers check queuedJobs.
+	if (--*job.mCounter == 0) {
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		waitCondition.notify_all();
+	}
+}
+
+void JobSystem::workerLoop(int threadIndex) {
+	currentJobSystem = this;
+	currentIndex = threadIndex;
+
+	Job job;
+	while (true) {
+		if (popOrSteal(threadIndex, job)) {
+			execute(job, threadIndex);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeCondition.wait(lock, [this]() { return quit || queuedJobs > 0; });
+		if (quit) {
+			return;
+		}
+	}
+}
+
+void JobSystem::wait(const std::atomic<int>& counter) {
+	int threadIndex = currentThreadIndex();
+	if (threadIndex == -1) {
+		threadIndex = 0;
+	}
+
+	// when called from a job, the jobs that this thread runs here may be unrelated to 'counter', 
+	// but all of them finish without waiting for the job that called wait().
+	Job job;
+	while (counter > 0) {
+		if (popOrSteal(threadIndex, job)) {
+			execute(job, threadIndex);
+			continue;
+		}
+
+		// the remaining jobs are running on other threads, so sleep until they are done, or until more jobs are queued.
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		waitCondition.wait(lock, [this, &counter]() { return counter == 0 || queuedJobs > 0; });
+	}
+}
+
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+namespace reglCpp
+{
+
+/*
+A small work-stealing job system. Every thread has its own queue of jobs: a thread pushes and pops jobs 
+at the back of its own queue, and when it runs out of work it steals from the front of the queues of the others.
+The thread that created the JobSystem is thread 0, and every thread runs jobs too while it is in wait(), 
+so jobs can spawn more jobs and wait for them.
+
+It is meant for splitting up the CPU work of a frame, such as recording draws into the per thread
+recorders of reglCppContext, see reglCppContext::recorder().
+*/
+class JobSystem {
+public:
+	/*
+	A job is a function and a pointer to its data, so that queueing it doesn't allocate. 'begin' and 'end' are passed 
+	to the function along with the data, which is how parallelFor() hands out its chunks.
+	mCounter is incremented by run() and decremented once the job has finished, see wait().
+	*/
+	struct Job {
+		void (*mFunction)(const void* data, int begin, int end, int threadIndex);
+		const void* mData;
+		int mBegin;
+		int mEnd;
+		std::atomic<int>* mCounter;
+	};
+
+	// if numWorkers is negative, one worker is started per hardware thread, minus the calling thread.
+	explicit JobSystem(int numWorkers = -1);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// the number of threads that run jobs, including the thread that calls wait().
+	int numThreads() const {
+		return (int)queues.size();
+	}
+
+	void run(const Job& job);
+
+	// runs jobs on the calling thread until 'counter' is 0, that is until all the jobs that were run() with it are done.
+	// it can be called from a job, since the jobs that it waits for are run or stolen by this thread too.
+	void wait(const std::atomic<int>& counter);
+
+	// calls fn(begin, end, threadIndex) for chunks of at most chunkSize elements of [0, count), and waits for all of them.
+	// it can be called from a job, like wait().
+	template<typename Fn>
+	void parallelFor(int count, int chunkSize, const Fn& fn) {
+		if (chunkSize <= 0) {
+			chunkSize = 1;
+		}
+
+		std::atomic<int> counter(0);
+		for (int begin = 0; begin < count; begin += chunkSize) {
+			Job job;
+			job.mFunction = &CallChunk<Fn>;
+			job.mData = &fn;
+			job.mBegin = begin;
+			job.mEnd = begin + chunkSize < count ? begin + chunkSize : count;
+			job.mCounter = &counter;
+			run(job);
+		}
+
+		wait(counter);
+	}
+
+private:
+	template<typename Fn>
+	static void CallChunk(const void* data, int begin, int end, int threadIndex) {
+		(*static_cast<const Fn*>(data))(begin, end, threadIndex);
+	}
+
+	// a ring buffer of jobs, which only allocates when it has to grow.
+	struct Queue {
+		std::mutex mMutex;
+		std::vector<Job> mJobs;
+		size_t mFirst = 0;
+		size_t mNumJobs = 0;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+
+	// jobs that have been run() but not yet popped by a thread.
+	std::atomic<int> queuedJobs;
+
+	std::atomic<bool> quit;
+	std::mutex sleepMutex;
+	// the workers sleep on wakeCondition until there are jobs, and the threads in wait() on waitCondition
+	// until there are jobs or the counter they wait for is 0.
+	std::condition_variable wakeCondition;
+	std::condition_variable waitCondition;
+
+	// used when a thread that doesn't belong to the job system calls run().
+	std::atomic<unsigned int> nextQueue;
+
+	int currentThreadIndex() const;
+	bool popOrSteal(int threadIndex, Job& job);
+	void execute(const Job& job, int threadIndex);
+	void workerLoop(int threadIndex);
+};
+
+}
@@ -0,0 +1,534 @@
+#include "mesh-optimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace reglCpp {
+
+// the size of the LRU cache that optimizeVertexCache() optimizes for, and the constants of the scoring function.
+// these are the values from the paper of Forsyth.
+const int FORSYTH_CACHE_SIZE = 32;
+const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+// the cache that analyzeVertexFetch() fetches vertices through.
+const size_t FETCH_CACHE_LINE_SIZE = 64;
+const unsigned int FETCH_CACHE_NUM_LINES = 64;
+
+template<typename Index>
+inline void CheckIndices(const Index* indices, size_t indexCount, size_t vertexCount) {
+	if (indexCount % 3 != 0) {
+		printf("the %zu indices are not a list of triangles\n", indexCount);
+		exit(1);
+	}
+	for (size_t iIndex = 0; iIndex < indexCount; ++iIndex) {
+		if (indices[iIndex] >= vertexCount) {
+			printf("the index %u is out of range for %zu vertices\n", (unsigned int)indices[iIndex], vertexCount);
+			exit(1);
+		}
+	}
+}
+
+// a FIFO cache of 'size' elements. an element is cached if it was added less than 'size' additions ago.
+struct FifoCacheSimulation {
+	std::vector<unsigned int> mTimestamps;
+	unsigned int mTime;
+	unsigned int mSize;
+
+	FifoCacheSimulation(size_t numElements, unsigned int size) : mTimestamps(numElements, 0), mTime(size + 1), mSize(size) {
+	}
+
+	// returns 1 if the element was not in the cache, and had to be added.
+	int access(unsigned int element) {
+		if (mTime - mTimestamps[element] > mSize) {
+			mTimestamps[element] = mTime++;
+			return 1;
+		}
+		return 0;
+	}
+
+	// all elements become older than the size of the cache.
+	void flush() {
+		mTime += mSize + 1;
+	}
+};
+
+template<typename Index>
+inline unsigned int CountUsedVertices(const Index* indices, size_t indexCount, size_t vertexCount) {
+	std::vector<char> used(vertexCount, 0);
+	unsigned int numUsed = 0;
+	for (size_t iIndex = 0; iIndex < indexCount; ++iIndex) {
+		if (!used[indices[iIndex]]) {
+			used[indices[iIndex]] = 1;
+			++numUsed;
+		}
+	}
+	return numUsed;
+}
+
+template<typename Index>
+VertexCacheStats AnalyzeVertexCache(const Index* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize) {
+	CheckIndices(indices, indexCount, vertexCount);
+
+	VertexCacheStats stats;
+	stats.mNumTriangles = (unsigned int)(indexCount / 3);
+	stats.mNumVertices = CountUsedVertices(indices, indexCount, vertexCount);
+
+	FifoCacheSimulation cache(vertexCount, cacheSize);
+	for (size_t iIndex = 0; iIndex < indexCount; ++iIndex) {
+		stats.mNumTransformed += cache.access(indices[iIndex]);
+	}
+	return stats;
+}
+
+template<typename Index>
+VertexFetchStats AnalyzeVertexFetch(const Index* indices, size_t indexCount, size_t vertexCount, size_t vertexSize) {
+	CheckIndices(indices, indexCount, vertexCount);
+
+	VertexFetchStats stats;
+	stats.mBytesUsed = CountUsedVertices(indices, indexCount, vertexCount) * vertexSize;
+
+	FifoCacheSimulation vertexCache(vertexCount, VERTEX_CACHE_SIZE);
+	FifoCacheSimulation lineCache((vertexCount * vertexSize + FETCH_CACHE_LINE_SIZE - 1) / FETCH_CACHE_LINE_SIZE, FETCH_CACHE_NUM_LINES);
+
+	for (size_t iIndex = 0; iIndex < indexCount; ++iIndex) {
+		unsigned int vertex = indices[iIndex];
+		if (!vertexCache.access(vertex)) {
+			continue;
+		}
+
+		// a vertex may straddle two cache lines.
+		size_t firstLine = vertex * vertexSize / FETCH_CACHE_LINE_SIZE;
+		size_t lastLine = ((vertex + 1) * vertexSize - 1) / FETCH_CACHE_LINE_SIZE;
+		for (size_t iLine = firstLine; iLine <= lastLine; ++iLine) {
+			stats.mBytesFetched += lineCache.access((unsigned int)iLine) * FETCH_CACHE_LINE_SIZE;
+		}
+	}
+	return stats;
+}
+
+// the score of a vertex, from its position in the LRU cache, or -1 if it's not in it, and the number of triangles
+// that still use it. the valence boost makes vertices with few triangles left be finished first.
+inline float ForsythVertexScore(int cachePosition, unsigned int numLiveTriangles) {
+	if (numLiveTriangles == 0) {
+		return -1.0f;
+	}
+
+	float score = 0.0f;
+	if (cachePosition >= 3) {
+		float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+		score = powf(1.0f - (cachePosition - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+	} else if (cachePosition >= 0) {
+		// the vertices of the last triangle get a fixed score, so that the next triangle doesn't favour
+		// any particular edge of it.
+		score = FORSYTH_LAST_TRIANGLE_SCORE;
+	}
+
+	return score + FORSYTH_VALENCE_BOOST_SCALE * powf((float)numLiveTriangles, -FORSYTH_VALENCE_BOOST_POWER);
+}
+
+template<typename Index>
+void OptimizeVertexCache(Index* destination, const Index* indices, size_t indexCount, size_t vertexCount) {
+	CheckIndices(indices, indexCount, vertexCount);
+
+	std::vector<unsigned int> source(indices, indices + indexCount);
+	size_t numTriangles = indexCount / 3;
+
+	// the triangles that use each vertex, which have not been added yet, are at the start of its range of 'adjacency'.
+	std::vector<unsigned int> numLiveTriangles(vertexCount, 0);
+	for (size_t iIndex = 0; iIndex < indexCount; ++iIndex) {
+		++numLiveTriangles[source[iIndex]];
+	}
+
+	std::vector<unsigned int> firstAdjacency(vertexCount + 1, 0);
+	for (size_t iVertex = 0; iVertex < vertexCount; ++iVertex) {
+		firstAdjacency[iVertex + 1] = firstAdjacency[iVertex] + numLiveTriangles[iVertex];
+	}
+
+	std::vector<unsigned int> adjacency(indexCount);
+	{
+		std::vector<unsigned int> fill(firstAdjacency.begin(), firstAdjacency.end() - 1);
+		for (size_t iIndex = 0; iIndex < indexCount; ++iIndex) {
+			adjacency[fill[source[iIndex]]++] = (unsigned int)(iIndex / 3);
+		}
+	}
+
+	std::vector<int> cachePositions(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (size_t iVertex = 0; iVertex < vertexCount; ++iVertex) {
+		vertexScores[iVertex] = ForsythVertexScore(-1, numLiveTriangles[iVertex]);
+	}
+
+	std::vector<char> added(numTriangles, 0);
+
+	int bestTriangle = -1;
+	float bestScore = -1.0f;
+	for (size_t iTriangle = 0; iTriangle < numTriangles; ++iTriangle) {
+		float score =
+			vertexScores[source[iTriangle * 3 + 0]] +
+			vertexScores[source[iTriangle * 3 + 1]] +
+			vertexScores[source[iTriangle * 3 + 2]];
+		if (score > bestScore) {
+			bestScore = score;
+			bestTriangle = (int)iTriangle;
+		}
+	}
+
+	std::vector<unsigned int> cache;
+	std::vector<unsigned int> newCache;
+	cache.reserve(FORSYTH_CACHE_SIZE + 3);
+	newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+	// the first triangle that may not have been added, for when none of the vertices in the cache have triangles left.
+	size_t nextTriangle = 0;
+
+	for (size_t iOutput = 0; iOutput < numTriangles; ++iOutput) {
+		if (bestTriangle == -1) {
+			while (added[nextTriangle]) {
+				++nextTriangle;
+			}
+			bestTriangle = (int)nextTriangle;
+		}
+
+		const unsigned int* triangle = &source[bestTriangle * 3];
+		added[bestTriangle] = 1;
+		destination[iOutput * 3 + 0] = (Index)triangle[0];
+		destination[iOutput * 3 + 1] = (Index)triangle[1];
+		destination[iOutput * 3 + 2] = (Index)triangle[2];
+
+		for (int iCorner = 0; iCorner < 3; ++iCorner) {
+			unsigned int vertex = triangle[iCorner];
+			unsigned int* live = &adjacency[firstAdjacency[vertex]];
+			for (unsigned int iLive = 0; iLive < numLiveTriangles[vertex]; ++iLive) {
+				if (live[iLive] == (unsigned int)bestTriangle) {
+					live[iLive] = live[numLiveTriangles[vertex] - 1];
+					--numLiveTriangles[vertex];
+					break;
+				}
+			}
+		}
+
+		// the vertices of the triangle move to the front of the cache, and the rest are pushed back.
+		newCache.clear();
+		for (int iCorner = 0; iCorner < 3; ++iCorner) {
+			if (std::find(newCache.begin(), newCache.end(), triangle[iCorner]) == newCache.end()) {
+				newCache.push_back(triangle[iCorner]);
+			}
+		}
+		for (unsigned int vertex : cache) {
+			if (std::find(newCache.begin(), newCache.end(), vertex) == newCache.end()) {
+				newCache.push_back(vertex);
+			}
+		}
+		for (size_t iEvicted = FORSYTH_CACHE_SIZE; iEvicted < newCache.size(); ++iEvicted) {
+			unsigned int vertex = newCache[iEvicted];
+			cachePositions[vertex] = -1;
+			vertexScores[vertex] = ForsythVertexScore(-1, numLiveTriangles[vertex]);
+		}
+		if (newCache.size() > (size_t)FORSYTH_CACHE_SIZE) {
+			newCache.resize(FORSYTH_CACHE_SIZE);
+		}
+		cache.swap(newCache);
+
+		for (size_t iCache = 0; iCache < cache.size(); ++iCache) {
+			unsigned int vertex = cache[iCache];
+			cachePositions[vertex] = (int)iCache;
+			vertexScores[vertex] = ForsythVertexScore((int)iCache, numLiveTriangles[vertex]);
+		}
+
+		// only the triangles of the vertices in the cache changed score, so the next triangle is one of them.
+		bestTriangle = -1;
+		bestScore = -1.0f;
+		for (unsigned int vertex : cache) {
+			const unsigned int* live = &adjacency[firstAdjacency[vertex]];
+			for (unsigned int iLive = 0; iLive < numLiveTriangles[vertex]; ++iLive) {
+				unsigned int iTriangle = live[iLive];
+				float score =
+					vertexScores[source[iTriangle * 3 + 0]] +
+					vertexScores[source[iTriangle * 3 + 1]] +
+					vertexScores[source[iTriangle * 3 + 2]];
+				if (score > bestScore) {
+					bestScore = score;
+					bestTriangle = (int)iTriangle;
+				}
+			}
+		}
+	}
+}
+
+template<typename Index>
+void OptimizeOverdraw(Index* destination, const Index* indices, size_t indexCount,
+	const float* positions, size_t vertexCount, size_t positionStride, float threshold) {
+	CheckIndices(indices, indexCount, vertexCount);
+
+	std::vector<unsigned int> source(indices, indices + indexCount);
+	size_t numTriangles = indexCount / 3;
+	if (numTriangles == 0) {
+		return;
+	}
+
+	// hard boundaries are where all the vertices of a triangle miss the cache, so it effectively starts over.
+	std::vector<size_t> hardBoundaries;
+	{
+		FifoCacheSimulation cache(vertexCount, VERTEX_CACHE_SIZE);
+		for (size_t iTriangle = 0; iTriangle < numTriangles; ++iTriangle) {
+			int misses =
+				cache.access(source[iTriangle * 3 + 0]) +
+				cache.access(source[iTriangle * 3 + 1]) +
+				cache.access(source[iTriangle * 3 + 2]);
+			if (iTriangle == 0 || misses == 3) {
+				hardBoundaries.push_back(iTriangle);
+			}
+		}
+		hardBoundaries.push_back(numTriangles);
+	}
+
+	// the hard clusters are split further, as soon as the ACMR of the part of the cluster that starts
+	// with an empty cache is within the threshold of that of the whole cluster.
+	std::vector<size_t> clusters;
+	{
+		FifoCacheSimulation cache(vertexCount, VERTEX_CACHE_SIZE);
+		for (size_t iHard = 0; iHard + 1 < hardBoundaries.size(); ++iHard) {
+			size_t begin = hardBoundaries[iHard];
+			size_t end = hardBoundaries[iHard + 1];
+
+			cache.flush();
+			unsigned int clusterMisses = 0;
+			for (size_t iIndex = begin * 3; iIndex < end * 3; ++iIndex) {
+				clusterMisses += cache.access(source[iIndex]);
+			}
+			float maxAcmr = threshold * (float)clusterMisses / (float)(end - begin);
+
+			cache.flush();
+			clusters.push_back(begin);
+			size_t clusterBegin = begin;
+			unsigned int misses = 0;
+			for (size_t iTriangle = begin; iTriangle < end; ++iTriangle) {
+				misses +=
+					cache.access(source[iTriangle * 3 + 0]) +
+					cache.access(source[iTriangle * 3 + 1]) +
+					cache.access(source[iTriangle * 3 + 2]);
+
+				if (iTriangle + 1 < end && (float)misses / (float)(iTriangle + 1 - clusterBegin) <= maxAcmr) {
+					cache.flush();
+					clusterBegin = iTriangle + 1;
+					clusters.push_back(clusterBegin);
+					misses = 0;
+				}
+			}
+		}
+		clusters.push_back(numTriangles);
+	}
+
+	auto position = [&](unsigned int vertex) {
+		return (const float*)((const char*)positions + vertex * positionStride);
+	};
+
+	// the area weighted centroid and normal of every cluster, and the centroid of the whole mesh.
+	size_t numClusters = clusters.size() - 1;
+	std::vector<float> clusterCentroids(numClusters * 3, 0.0f);
+	std::vector<float> clusterNormals(numClusters * 3, 0.0f);
+	float meshCentroid[3] = { 0.0f, 0.0f, 0.0f };
+	float meshArea = 0.0f;
+
+	for (size_t iCluster = 0; iCluster < numClusters; ++iCluster) {
+		float* centroid = &clusterCentroids[iCluster * 3];
+		float* normal = &clusterNormals[iCluster * 3];
+		float clusterArea = 0.0f;
+
+		for (size_t iTriangle = clusters[iCluster]; iTriangle < clusters[iCluster + 1]; ++iTriangle) {
+			const float* p0 = position(source[iTriangle * 3 + 0]);
+			const float* p1 = position(source[iTriangle * 3 + 1]);
+			const float* p2 = position(source[iTriangle * 3 + 2]);
+
+			float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			float n[3] = {
+				e1[1] * e2[2] - e1[2] * e2[1],
+				e1[2] * e2[0] - e1[0] * e2[2],
+				e1[0] * e2[1] - e1[1] * e2[0] };
+			float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			for (int c = 0; c < 3; ++c) {
+				float triangleCentroid = (p0[c] + p1[c] + p2[c]) / 3.0f;
+				centroid[c] += triangleCentroid * area;
+				meshCentroid[c] += triangleCentroid * area;
+				normal[c] += n[c];
+			}
+			clusterArea += area;
+		}
+
+		if (clusterArea > 0.0f) {
+			for (int c = 0; c < 3; ++c) {
+				centroid[c] /= clusterArea;
+			}
+		}
+		meshArea += clusterArea;
+
+		float normalLength = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (normalLength > 0.0f) {
+			for (int c = 0; c < 3; ++c) {
+				normal[c] /= normalLength;
+			}
+		}
+	}
+
+	if (meshArea > 0.0f) {
+		for (int c = 0; c < 3; ++c) {
+			meshCentroid[c] /= meshArea;
+		}
+	}
+
+	// clusters that are far out along their normals are likely to occlude others, so they are drawn first.
+	std::vector<float> sortKeys(numClusters);
+	std::vector<size_t> order(numClusters);
+	for (size_t iCluster = 0; iCluster < numClusters; ++iCluster) {
+		const float* centroid = &clusterCentroids[iCluster * 3];
+		const float* normal = &clusterNormals[iCluster * 3];
+		sortKeys[iCluster] =
+			(centroid[0] - meshCentroid[0]) * normal[0] +
+			(centroid[1] - meshCentroid[1]) * normal[1] +
+			(centroid[2] - meshCentroid[2]) * normal[2];
+		order[iCluster] = iCluster;
+	}
+	std::stable_sort(order.begin(), order.end(), [&sortKeys](size_t a, size_t b) {
+		return sortKeys[a] > sortKeys[b];
+	});
+
+	size_t iOutput = 0;
+	for (size_t iCluster : order) {
+		for (size_t iIndex = clusters[iCluster] * 3; iIndex < clusters[iCluster + 1] * 3; ++iIndex) {
+			destination[iOutput++] = (Index)source[iIndex];
+		}
+	}
+}
+
+template<typename Index>
+size_t OptimizeVertexFetchRemap(unsigned int* remap, const Index* indices, size_t indexCount, size_t vertexCount) {
+	CheckIndices(indices, indexCount, vertexCount);
+
+	for (size_t iVertex = 0; iVertex < vertexCount; ++iVertex) {
+		remap[iVertex] = ~0u;
+	}
+
+	unsigned int numUsed = 0;
+	for (size_t iIndex = 0; iIndex < indexCount; ++iIndex) {
+		if (remap[indices[iIndex]] == ~0u) {
+			remap[indices[iIndex]] = numUsed++;
+		}
+	}
+	return numUsed;
+}
+
+template<typename Index>
+void RemapIndices(Index* destination, const Index* indices, size_t indexCount, const unsigned int* remap) {
+	for (size_t iIndex = 0; iIndex < indexCount; ++iIndex) {
+		destination[iIndex] = (Index)remap[indices[iIndex]];
+	}
+}
+
+void remapVertices(void* destination, const void* vertices, size_t vertexCount, size_t vertexSize, const unsigned int* remap) {
+	for (size_t iVertex = 0; iVertex < vertexCount; ++iVertex) {
+		if (remap[iVertex] != ~0u) {
+			memcpy((char*)destination + remap[iVertex] * vertexSize, (const char*)vertices + iVertex * vertexSize, vertexSize);
+		}
+	}
+}
+
+template<typename Index>
+MeshOptimizationReport OptimizeMesh(std::vector<Index>& indices, void* vertices, size_t vertexCount, size_t vertexSize, size_t positionOffset) {
+	MeshOptimizationReport report;
+	report.mCacheBefore = analyzeVertexCache(indices.data(), indices.size(), vertexCount);
+	report.mFetchBefore = analyzeVertexFetch(indices.data(), indices.size(), vertexCount, vertexSize);
+
+	optimizeVertexCache(indices.data(), indices.data(), indices.size(), vertexCount);
+
+	const float* positions = (const float*)((const char*)vertices + positionOffset);
+	optimizeOverdraw(indices.data(), indices.data(), indices.size(), positions, vertexCount, vertexSize);
+
+	std::vector<unsigned int> remap(vertexCount);
+	report.mNumVertices = optimizeVertexFetchRemap(remap.data(), indices.data(), indices.size(), vertexCount);
+	remapIndices(indices.data(), indices.data(), indices.size(), remap.data());
+
+	std::vector<unsigned char> remapped(report.mNumVertices * vertexSize);
+	remapVertices(remapped.data(), vertices, vertexCount, vertexSize, remap.data());
+	memcpy(vertices, remapped.data(), remapped.size());
+
+	report.mCacheAfter = analyzeVertexCache(indices.data(), indices.size(), report.mNumVertices);
+	report.mFetchAfter = analyzeVertexFetch(indices.data(), indices.size(), report.mNumVertices, vertexSize);
+	return report;
+}
+
+// the entry points for 16 and 32 bit indices.
+
+VertexCacheStats analyzeVertexCache(const unsigned short* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize) {
+	return AnalyzeVertexCache(indices, indexCount, vertexCount, cacheSize);
+}
+
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize) {
+	return AnalyzeVertexCache(indices, indexCount, vertexCount, cacheSize);
+}
+
+VertexFetchStats analyzeVertexFetch(const unsigned short* indices, size_t indexCount, size_t vertexCount, size_t vertexSize) {
+	return AnalyzeVertexFetch(indices, indexCount, vertexCount, vertexSize);
+}
+
+VertexFetchStats analyzeVertexFetch(const unsigned int* indices, size_t indexCount, size_t vertexCount, size_t vertexSize) {
+	return AnalyzeVertexFetch(indices, indexCount, vertexCount, vertexSize);
+}
+
+void optimizeVertexCache(unsigned short* destination, const unsigned short* indices, size_t indexCount, size_t vertexCount) {
+	OptimizeVertexCache(destination, indices, indexCount, vertexCount);
+}
+
+void optimizeVertexCache(unsigned int* destination, const unsigned int* indices, size_t indexCount, size_t vertexCount) {
+	OptimizeVertexCache(destination, indices, indexCount, vertexCount);
+}
+
+void optimizeOverdraw(unsigned short* destination, const unsigned short* indices, size_t indexCount,
+	const float* positions, size_t vertexCount, size_t positionStride, float threshold) {
+	OptimizeOverdraw(destination, indices, indexCount, positions, vertexCount, positionStride, threshold);
+}
+
+void optimizeOverdraw(unsigned int* destination, const unsigned int* indices, size_t indexCount,
+	const float* positions, size_t vertexCount, size_t positionStride, float threshold) {
+	OptimizeOverdraw(destination, indices, indexCount, positions, vertexCount, positionStride, threshold);
+}
+
+size_t optimizeVertexFetchRemap(unsigned int* remap, const unsigned short* indices, size_t indexCount, size_t vertexCount) {
+	return OptimizeVertexFetchRemap(remap, indices, indexCount, vertexCount);
+}
+
+size_t optimizeVertexFetchRemap(unsigned int* remap, const unsigned int* indices, size_t indexCount, size_t vertexCount) {
+	return OptimizeVertexFetchRemap(remap, indices, indexCount, vertexCount);
+}
+
+void remapIndices(unsigned short* destination, const unsigned short* indices, size_t indexCount, const unsigned int* remap) {
+	RemapIndices(destination, indices, indexCount, remap);
+}
+
+void remapIndices(unsigned int* destination, const unsigned int* indices, size_t indexCount, const unsigned int* remap) {
+	RemapIndices(destination, indices, indexCount, remap);
+}
+
+MeshOptimizationReport optimizeMesh(std::vector<unsigned short>& indices, void* vertices, size_t vertexCount, size_t vertexSize, size_t positionOffset) {
+	return OptimizeMesh(indices, vertices, vertexCount, vertexSize, positionOffset);
+}
+
+MeshOptimizationReport optimizeMesh(std::vector<unsigned int>& indices, void* vertices, size_t vertexCount, size_t vertexSize, size_t positionOffset) {
+	return OptimizeMesh(indices, vertices, vertexCount, vertexSize, positionOffset);
+}
+
+void MeshOptimizationReport::print(const char* name) const {
+	printf("%s: %u triangles, %zu vertices\n", name, mCacheAfter.mNumTriangles, mNumVertices);
+	printf("  ACMR      %.3f -> %.3f\n", mCacheBefore.acmr(), mCacheAfter.acmr());
+	printf("  ATVR      %.3f -> %.3f\n", mCacheBefore.atvr(), mCacheAfter.atvr());
+	printf("  overfetch %.3f -> %.3f\n", mFetchBefore.overfetch(), mFetchAfter.overfetch());
+}
+
+}
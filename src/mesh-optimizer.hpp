@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+namespace reglCpp
+{
+
+/*
+CPU optimizations of indexed triangle meshes, meant to be run after a mesh has been loaded, and before its
+data is given to a VertexBuffer and an IndexBuffer. None of them change what is rendered: triangles are only
+reordered, with their vertices in the same order, and vertices are only moved around.
+
+In the order they should be run, which is what optimizeMesh() does:
+optimizeVertexCache() orders the triangles so that their vertices are still in the post-transform cache of the GPU.
+optimizeOverdraw() splits that order into clusters, and draws the clusters that face outwards first.
+optimizeVertexFetchRemap() orders the vertices by their first use, so that they are fetched from memory in order.
+*/
+
+// the number of vertices in the post-transform cache that is simulated by the analyze functions.
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+	unsigned int mNumTransformed = 0;
+	unsigned int mNumTriangles = 0;
+	unsigned int mNumVertices = 0; // the vertices used by the triangles.
+
+	// average cache miss ratio, the vertex shader invocations per triangle. between 0.5 and 3, lower is better.
+	double acmr() const {
+		return mNumTriangles == 0 ? 0.0 : (double)mNumTransformed / (double)mNumTriangles;
+	}
+
+	// average transform to vertex ratio, the vertex shader invocations per vertex. 1 is optimal.
+	double atvr() const {
+		return mNumVertices == 0 ? 0.0 : (double)mNumTransformed / (double)mNumVertices;
+	}
+};
+
+struct VertexFetchStats {
+	size_t mBytesFetched = 0; // in whole cache lines.
+	size_t mBytesUsed = 0; // the size of the vertices used by the triangles.
+
+	// the bytes fetched per byte of vertex data. 1 is optimal.
+	double overfetch() const {
+		return mBytesUsed == 0 ? 0.0 : (double)mBytesFetched / (double)mBytesUsed;
+	}
+};
+
+struct MeshOptimizationReport {
+	VertexCacheStats mCacheBefore;
+	VertexCacheStats mCacheAfter;
+	VertexFetchStats mFetchBefore;
+	VertexFetchStats mFetchAfter;
+
+	// the vertices that are left, since vertices that no triangle uses are removed.
+	size_t mNumVertices = 0;
+
+	void print(const char* name) const;
+};
+
+/*
+All the functions take triangle lists of 16 or 32 bit indices, like the ones that IndexBuffer::data() takes, so that
+a mesh can be optimized in the index type it is drawn with.
+*/
+
+// simulates a FIFO post-transform cache of 'cacheSize' vertices.
+VertexCacheStats analyzeVertexCache(const unsigned short* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE);
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE);
+
+// simulates fetching the vertices that miss the post-transform cache, through a small cache of 64 byte lines.
+VertexFetchStats analyzeVertexFetch(const unsigned short* indices, size_t indexCount, size_t vertexCount, size_t vertexSize);
+VertexFetchStats analyzeVertexFetch(const unsigned int* indices, size_t indexCount, size_t vertexCount, size_t vertexSize);
+
+// reorders the triangles with the algorithm of Tom Forsyth, "Linear-Speed Vertex Cache Optimisation".
+// 'destination' may be 'indices'.
+void optimizeVertexCache(unsigned short* destination, const unsigned short* indices, size_t indexCount, size_t vertexCount);
+void optimizeVertexCache(unsigned int* destination, const unsigned int* indices, size_t indexCount, size_t vertexCount);
+
+// reorders clusters of triangles that were ordered by optimizeVertexCache(), as in Sander et al., "Fast Triangle Reordering
+// for Vertex Locality and Reduced Overdraw". a cluster ends where its ACMR is within 'threshold' times that of the
+// input, so the ACMR is at most that much worse. the positions are three floats, 'positionStride' bytes apart.
+// 'destination' may be 'indices'.
+void optimizeOverdraw(unsigned short* destination, const unsigned short* indices, size_t indexCount,
+	const float* positions, size_t vertexCount, size_t positionStride, float threshold = 1.05f);
+void optimizeOverdraw(unsigned int* destination, const unsigned int* indices, size_t indexCount,
+	const float* positions, size_t vertexCount, size_t positionStride, float threshold = 1.05f);
+
+// fills 'remap' with the new index of every vertex, in the order that they are first used by 'indices'.
+// vertices that are not used are remapped to ~0u. returns the number of used vertices.
+size_t optimizeVertexFetchRemap(unsigned int* remap, const unsigned short* indices, size_t indexCount, size_t vertexCount);
+size_t optimizeVertexFetchRemap(unsigned int* remap, const unsigned int* indices, size_t indexCount, size_t vertexCount);
+
+// 'destination' may be 'indices'.
+void remapIndices(unsigned short* destination, const unsigned short* indices, size_t indexCount, const unsigned int* remap);
+void remapIndices(unsigned int* destination, const unsigned int* indices, size_t indexCount, const unsigned int* remap);
+
+// 'destination' must not be 'vertices'.
+void remapVertices(void* destination, const void* vertices, size_t vertexCount, size_t vertexSize, const unsigned int* remap);
+
+// runs all of the optimizations, in place. the vertices are 'vertexSize' bytes each, with the position as three floats
+// at 'positionOffset'. the vertices after report.mNumVertices are no longer used, and can be removed.
+MeshOptimizationReport optimizeMesh(std::vector<unsigned short>& indices, void* vertices, size_t vertexCount, size_t vertexSize, size_t positionOffset);
+MeshOptimizationReport optimizeMesh(std::vector<unsigned int>& indices, void* vertices, size_t vertexCount, size_t vertexSize, size_t positionOffset);
+
+}
@@ -9,6 +9,15 @@
 
 #include <GLFW/glfw3.h>
 
+#include <unordered_map>
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <regex>
+#include <cstring>
+#include <chrono>
+
 #define  LOGI(...)  printf(__VA_ARGS__)
 #define  LOGE(...)  printf(__VA_ARGS__)
 
@@ -38,41 +47,381 @@ namespace reglCpp {
 
 reglCppContext context;
 
-void reglCppContext::frame(const std::function<void()>& fn) {
-	contextState initialState;
-	stateStack.push(initialState);
-	fn();
+// function local, so that symbols can be interned during static initialization.
+static std::unordered_map<std::string, unsigned int>& SymbolIds() {
+	static std::unordered_map<std::string, unsigned int> symbolIds;
+	return symbolIds;
+}
+
+// a deque, so that references returned by symbolName() stay valid.
+static std::deque<std::string>& SymbolNames() {
+	static std::deque<std::string> symbolNames;
+	return symbolNames;
+}
+
+// names may be interned from the threads that record draws.
+static std::mutex symbolMutex;
+static std::atomic<unsigned int> symbolCount(0);
+
+unsigned int internSymbol(const std::string& name) {
+	// the names that the calling thread has already interned are found without taking the lock,
+	// so that threads interning the same names don't wait for each other.
+	static thread_local std::unordered_map<std::string, unsigned int> threadSymbolIds;
+	auto threadIt = threadSymbolIds.find(name);
+	if (threadIt != threadSymbolIds.end()) {
+		return threadIt->second;
+	}
+
+	unsigned int id;
+	{
+		std::lock_guard<std::mutex> lock(symbolMutex);
+
+		auto it = SymbolIds().find(name);
+		if (it != SymbolIds().end()) {
+			id = it->second;
+		} else {
+			id = (unsigned int)SymbolNames().size();
+			SymbolNames().push_back(name);
+			SymbolIds()[name] = id;
+			++symbolCount;
+		}
+	}
+
+	threadSymbolIds[name] = id;
+	return id;
+}
+
+const std::string& symbolName(unsigned int id) {
+	std::lock_guard<std::mutex> lock(symbolMutex);
+	return SymbolNames()[id];
+}
+
+unsigned int numSymbols() {
+	return symbolCount;
+}
+
+static std::vector<std::string>& DefineNames() {
+	static std::vector<std::string> defineNames;
+	return defineNames;
+}
+
+static std::mutex defineMutex;
+
+unsigned long long defineBit(const std::string& name) {
+	std::lock_guard<std::mutex> lock(defineMutex);
+
+	std::vector<std::string>& defineNames = DefineNames();
+	auto it = std::find(defineNames.begin(), defineNames.end(), name);
+	if (it != defineNames.end()) {
+		return 1ull << (it - defineNames.begin());
+	}
+
+	if (defineNames.size() == 64) {
+		printf("too many different shader defines, at most 64 are supported\n");
+		exit(1);
+	}
+	defineNames.push_back(name);
+	return 1ull << (defineNames.size() - 1);
+}
+
+// the '#define' lines of all the defines in the set, sorted by name, so that the source doesn't depend on the bits.
+static std::string DefineLines(unsigned long long defines) {
+	std::vector<std::string> names;
+	{
+		std::lock_guard<std::mutex> lock(defineMutex);
+		for (size_t iBit = 0; iBit < DefineNames().size(); ++iBit) {
+			if (defines & (1ull << iBit)) {
+				names.push_back(DefineNames()[iBit]);
+			}
+		}
+	}
+	std::sort(names.begin(), names.end());
+
+	std::string lines;
+	for (const std::string& name : names) {
+		lines += "#define " + name + "\n";
+	}
+	return lines;
+}
+
+// 64 bit FNV-1a.
+unsigned long long shaderHash(const std::string& source) {
+	unsigned long long hash = 14695981039346656037ull;
+	for (char c : source) {
+		hash ^= (unsigned char)c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+unsigned short halfFloat(float value) {
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	unsigned int sign = (bits >> 16) & 0x8000;
+	int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+	unsigned int mantissa = bits & 0x7fffff;
+
+	if (((bits >> 23) & 0xff) == 0xff) {
+		// infinity stays infinity, and NaN stays NaN.
+		return (unsigned short)(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+	}
+	if (exponent >= 31) {
+		// too large, so it becomes infinity.
+		return (unsigned short)(sign | 0x7c00);
+	}
+	if (exponent <= 0) {
+		// a denormal, or zero if it is too small for that too.
+		if (exponent < -10) {
+			return (unsigned short)sign;
+		}
+		mantissa |= 0x800000;
+		unsigned int shift = (unsigned int)(14 - exponent);
+		unsigned int half = mantissa >> shift;
+		// round to nearest even.
+		unsigned int rest = mantissa & ((1u << shift) - 1);
+		unsigned int halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1))) {
+			++half;
+		}
+		return (unsigned short)(sign | half);
+	}
+
+	unsigned int half = sign | ((unsigned int)exponent << 10) | (mantissa >> 13);
+	unsigned int rest = mantissa & 0x1fff;
+	// rounding up may carry into the exponent, which gives the correct result, up to infinity.
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+		++half;
+	}
+	return (unsigned short)half;
+}
+
+unsigned int packInt10_10_10_2(float x, float y, float z, float w) {
+	auto pack = [](float value, int bits) {
+		int maxValue = (1 << (bits - 1)) - 1;
+		value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+		int packed = (int)roundf(value * (float)maxValue);
+		return (unsigned int)packed & ((1u << bits) - 1);
+	};
+	return pack(x, 10) | (pack(y, 10) << 10) | (pack(z, 10) << 20) | (pack(w, 2) << 30);
+}
+
+// the capacities of the containers of a Command, which only change when they allocate.
+inline std::array<size_t, 5> CommandCapacities(const Command& command) {
+	return { { command.mUniforms.capacity(), command.mAttributes.capacity(), 
+		command.mVert.capacity(), command.mFrag.capacity(), command.mPrimitive.capacity() } };
+}
+
+void reglCppContext::beginFrame() {
+	stateStack.clear();
+	++frameIndex;
+
+	stats.mFrameArenaBytes = frameArena.mUsed;
+	frameArena.reset();
+	numFrameCommands = 0;
+	// the chunk that reset() merged the chunks of the last frame into.
+	countFrameHeapAllocations();
+}
+
+void reglCppContext::countFrameHeapAllocations() {
+	stats.mFrameHeapAllocations += frameArena.mHeapAllocations - frameArenaHeapAllocations;
+	frameArenaHeapAllocations = frameArena.mHeapAllocations;
+
+	// the Commands of the frame allocated while they were built if their containers grew.
+	for (size_t iCommand = 0; iCommand < numFrameCommands; ++iCommand) {
+		FrameCommand& pooledCommand = *frameCommands[iCommand];
+		std::array<size_t, 5> capacities = CommandCapacities(pooledCommand.mCommand);
+		for (size_t iContainer = 0; iContainer < capacities.size(); ++iContainer) {
+			if (capacities[iContainer] != pooledCommand.mCapacities[iContainer]) {
+				++stats.mFrameHeapAllocations;
+			}
+		}
+		pooledCommand.mCapacities = capacities;
+	}
+}
+
+FrameArena::~FrameArena() {
+	for (const Chunk& chunk : mChunks) {
+		free(chunk.mData);
+	}
+}
+
+void* FrameArena::allocate(size_t size, size_t alignment) {
+	size_t start = (mOffset + alignment - 1) & ~(alignment - 1);
+	if (mChunks.empty() || start + size > mChunks.back().mSize) {
+		// the chunks double in size, so a frame only needs a few of them before the next reset() merges them.
+		size_t chunkSize = mChunks.empty() ? 64 * 1024 : mChunks.back().mSize * 2;
+		while (chunkSize < size + alignment) {
+			chunkSize *= 2;
+		}
+
+		unsigned char* data = (unsigned char*)malloc(chunkSize);
+		if (data == nullptr) {
+			printf("could not allocate a frame arena chunk of %zu bytes\n", chunkSize);
+			exit(1);
+		}
+		++mHeapAllocations;
+		mChunks.push_back({ data, chunkSize });
+
+		// malloc returns memory that is aligned for any type.
+		mOffset = 0;
+		start = 0;
+	}
+
+	mUsed += (start - mOffset) + size;
+	mOffset = start + size;
+	return mChunks.back().mData + start;
+}
+
+void FrameArena::reset() {
+	if (mChunks.size() > 1) {
+		size_t totalSize = 0;
+		for (const Chunk& chunk : mChunks) {
+			totalSize += chunk.mSize;
+			free(chunk.mData);
+		}
+		mChunks.clear();
+
+		unsigned char* data = (unsigned char*)malloc(totalSize);
+		if (data == nullptr) {
+			printf("could not allocate a frame arena chunk of %zu bytes\n", totalSize);
+			exit(1);
+		}
+		++mHeapAllocations;
+		mChunks.push_back({ data, totalSize });
+	}
+	mOffset = 0;
+	mUsed = 0;
+}
+
+Command& reglCppContext::frameCommand() {
+	if (numFrameCommands == frameCommands.size()) {
+		size_t capacity = frameCommands.capacity();
+		frameCommands.push_back(std::unique_ptr<FrameCommand>(new FrameCommand()));
+		// the Command, and the pool if it had to grow.
+		stats.mFrameHeapAllocations += frameCommands.capacity() != capacity ? 2 : 1;
+	}
+	FrameCommand& pooledCommand = *frameCommands[numFrameCommands++];
+	pooledCommand.mCommand.reset();
+	pooledCommand.mCapacities = CommandCapacities(pooledCommand.mCommand);
+	return pooledCommand.mCommand;
+}
+
+void reglCppContext::endFrame() {
+	// replay everything that was recorded on the worker threads during the frame.
+	bool recorded = false;
+	for (CommandBuffer& threadRecorder : recorders) {
+		if (!threadRecorder.mDraws.empty()) {
+			commandBuffer.append(threadRecorder);
+			threadRecorder.clear();
+			recorded = true;
+		}
+	}
+	if (recorded) {
+		commandBuffer.mContext = this;
+		commandBuffer.flush();
+	}
+
+	// the chunks that the frame arena allocated during the frame, and the growth of the frameCommand()s.
+	countFrameHeapAllocations();
+
+#ifndef EMSCRIPTEN
+	// the fence of the frame replaces the one from NUM_REGIONS frames ago.
+	if (numStreamingBuffers > 0) {
+		FrameFence& fence = frameFences[frameIndex % frameFences.size()];
+		if (fence.mSync != nullptr) {
+			GL_C(glDeleteSync((GLsync)fence.mSync));
+		}
+		GL_C(fence.mSync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+		fence.mFrame = frameIndex;
+	}
+#endif
+}
+
+// the value of the prop 'value', read from 'props'.
+inline UniformValue ResolveProp(const UniformValue& value, const void* props) {
+	if (props == nullptr) {
+		printf("a command with props was submitted without props\n");
+		exit(1);
+	}
+
+	size_t size = 0;
+	switch (value.mProp.mType) {
+	case UniformValue::FLOAT_VEC1: size = sizeof(float) * 1; break;
+	case UniformValue::FLOAT_VEC2: size = sizeof(float) * 2; break;
+	case UniformValue::FLOAT_VEC3: size = sizeof(float) * 3; break;
+	case UniformValue::FLOAT_VEC4: size = sizeof(float) * 4; break;
+	case UniformValue::FLOAT_MAT4X4: size = sizeof(float) * 16; break;
+	case UniformValue::TEXTURE2D: size = sizeof(Texture2D*); break;
+	default: break;
+	}
+
+	// all the members of the union start at the same address.
+	UniformValue resolved;
+	memcpy(&resolved.mFloatMat4x4, (const char*)props + value.mProp.mOffset, size);
+	resolved.mType = value.mProp.mType;
+	return resolved;
 }
 
-void reglCppContext::transferStack(contextState& stackState, const Command& command) {
+void reglCppContext::transferStack(contextState& stackState, const Command& command, const void* props) {
 	if (command.mIndices != nullptr) {
 		stackState.mIndices = command.mIndices;
 	}
 	if (command.mCount != -1) {
 		stackState.mCount = command.mCount;
 	}
-	for (Attribute attribute : command.mAttributes) {
-		stackState.mAttributes[attribute.mKey] = attribute.mVertexBuffer;
+	if (command.mInstances != -1) {
+		stackState.mInstances = command.mInstances;
+	}
+	if (command.mFirst != -1) {
+		stackState.mFirst = command.mFirst;
+	}
+	if (command.mBaseVertex != -1) {
+		stackState.mBaseVertex = command.mBaseVertex;
+	}
+	for (const Attribute& attribute : command.mAttributes) {
+		unsigned int id = attribute.mKey.mId;
+		if (stackState.mAttributes[id] == nullptr) {
+			stackState.mAttributeIds.push_back(id);
+		}
+		stackState.mAttributes[id] = attribute.mVertexBuffer;
 	}
 
-	for (Uniform uniform : command.mUniforms) {
-		stackState.mUniforms[uniform.mKey] = uniform.mValue;
+	for (const Uniform& uniform : command.mUniforms) {
+		unsigned int id = uniform.mKey.mId;
+		if (stackState.mUniforms[id] == nullptr) {
+			stackState.mUniformIds.push_back(id);
+		}
+		if (uniform.mValue.mType == UniformValue::PROP) {
+			stackState.mPropValues[id] = ResolveProp(uniform.mValue, props);
+			stackState.mUniforms[id] = &stackState.mPropValues[id];
+		} else {
+			stackState.mUniforms[id] = &uniform.mValue;
+		}
 	}
 
 	if (command.mDepthTest.second) {
 		stackState.mDepthTest = command.mDepthTest.first;
 	}
 
-	if (command.mVert != "") {
-		stackState.mVert = command.mVert;
+	if (command.mOrdered.second) {
+		stackState.mOrdered = command.mOrdered.first;
 	}
 
-	if (command.mFrag != "") {
-		stackState.mFrag = command.mFrag;
+	if (!command.mVert.empty()) {
+		stackState.mVert = &command.mVert;
+		stackState.mVertHash = command.mVertHash;
 	}
 
-	if (command.mPrimitive != "") {
-		stackState.mPrimitive = command.mPrimitive;
+	if (!command.mFrag.empty()) {
+		stackState.mFrag = &command.mFrag;
+		stackState.mFragHash = command.mFragHash;
+	}
+
+	stackState.mDefines |= command.mDefines;
+
+	if (!command.mPrimitive.empty()) {
+		stackState.mPrimitive = &command.mPrimitive;
 	}
 	
 	if (
@@ -98,139 +447,651 @@ void reglCppContext::transferStack(contextState& stackState, const Command& comm
 
 }
 
-VertexBuffer& VertexBuffer::finish() {
-	int glUsage;
-	
-	if (mUsage == "static") {
-		glUsage = GL_STATIC_DRAW;
+void reglCppContext::resolveState(const Command& command, const void* props, contextState& state) {
+	// the scopes were resolved when they were entered, so only the command itself is applied here.
+	if (resolvedStates.empty()) {
+		resolvedStates.emplace_back();
 	}
-	else if (mUsage == "dynamic") {
-		glUsage = GL_DYNAMIC_DRAW;
+	state.assign(resolvedStates[stateStack.size()], numSymbols());
+	transferStack(state, command, props);
+}
+
+BufferPool::Allocation BufferPool::allocate(unsigned int size, unsigned int alignment) {
+	if (alignment == 0) {
+		alignment = 1;
 	}
-	else if (mUsage == "stream") {
-		glUsage = GL_STREAM_DRAW;
+
+	// blocks start at multiples of MIN_BLOCK_SIZE, so other alignments need room for padding.
+	unsigned int padding = MIN_BLOCK_SIZE % alignment == 0 ? 0 : alignment - 1;
+	int order = 0;
+	while ((unsigned long long)MIN_BLOCK_SIZE << order < (unsigned long long)size + padding) {
+		++order;
 	}
-	else {
-		printf("'%s' is not a valid valid of vertex buffer 'usage'\n", mUsage.c_str());
-		exit(1);
+
+	// the smallest free block that is large enough, in any of the arenas.
+	int arenaIndex = -1;
+	int blockOrder = -1;
+	for (size_t iArena = 0; iArena < mArenas.size(); ++iArena) {
+		const Arena& arena = mArenas[iArena];
+		for (int iOrder = order; iOrder < (int)arena.mFreeBlocks.size(); ++iOrder) {
+			if (!arena.mFreeBlocks[iOrder].empty()) {
+				if (blockOrder == -1 || iOrder < blockOrder) {
+					arenaIndex = (int)iArena;
+					blockOrder = iOrder;
+				}
+				break;
+			}
+		}
 	}
 
-	// 1, 2, 3, 4.
-	if (mNumComponents <= 0 || mNumComponents >= 5) {
-		printf("'%d' is not a valid  number of vertex buffer components\n", mNumComponents);
-		exit(1);
+	if (arenaIndex == -1) {
+		int maxOrder = 0;
+		while ((MIN_BLOCK_SIZE << maxOrder) < mArenaSize || maxOrder < order) {
+			++maxOrder;
+			if (maxOrder >= 23) {
+				printf("can't allocate %u bytes from a buffer pool\n", size);
+				exit(1);
+			}
+		}
+
+		Arena arena;
+		arena.mSize = MIN_BLOCK_SIZE << maxOrder;
+		arena.mFreeBlocks.resize(maxOrder + 1);
+		arena.mFreeBlocks[maxOrder].insert(0);
+
+		// the copy write target is used for all writes, since binding the element array buffer changes the vertex array.
+		GL_C(glGenBuffers(1, &arena.mBufferObject));
+		GL_C(glBindBuffer(GL_COPY_WRITE_BUFFER, arena.mBufferObject));
+		GL_C(glBufferData(GL_COPY_WRITE_BUFFER, arena.mSize, nullptr, GL_STATIC_DRAW));
+		GL_C(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+
+		mArenas.push_back(arena);
+		arenaIndex = (int)mArenas.size() - 1;
+		blockOrder = maxOrder;
 	}
-	
-	if (mLength < 0) {
-		printf("'%d' is not a valid vertex buffer length\n", mLength);
-		exit(1);
+
+	// split the block in halves, until it is as small as possible.
+	Arena& arena = mArenas[arenaIndex];
+	unsigned int block = *arena.mFreeBlocks[blockOrder].begin();
+	arena.mFreeBlocks[blockOrder].erase(arena.mFreeBlocks[blockOrder].begin());
+	while (blockOrder > order) {
+		--blockOrder;
+		arena.mFreeBlocks[blockOrder].insert(block + (MIN_BLOCK_SIZE << blockOrder));
 	}
 
-	if (mData == nullptr) {
-		printf("Need to specify data for vertex buffer\n");
-		exit(1);
+	Allocation allocation;
+	allocation.mArena = arenaIndex;
+	allocation.mBlock = block;
+	allocation.mOrder = order;
+	allocation.mOffset = (block + alignment - 1) / alignment * alignment;
+	allocation.mSize = size;
+
+	++mNumAllocations;
+	mRequestedBytes += size;
+	mBlockBytes += MIN_BLOCK_SIZE << order;
+	return allocation;
+}
+
+void BufferPool::release(const Allocation& allocation) {
+	Arena& arena = mArenas[allocation.mArena];
+
+	// merge the block with its buddy, for as long as the buddy is free.
+	unsigned int block = allocation.mBlock;
+	int order = allocation.mOrder;
+	while (order + 1 < (int)arena.mFreeBlocks.size()) {
+		unsigned int buddy = block ^ (MIN_BLOCK_SIZE << order);
+		auto it = arena.mFreeBlocks[order].find(buddy);
+		if (it == arena.mFreeBlocks[order].end()) {
+			break;
+		}
+		arena.mFreeBlocks[order].erase(it);
+		block = block < buddy ? block : buddy;
+		++order;
 	}
+	arena.mFreeBlocks[order].insert(block);
 
-	GL_C(glGenBuffers(1, &mBufferObject.first));
-	GL_C(glBindBuffer(GL_ARRAY_BUFFER, mBufferObject.first));
-	GL_C(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * mNumComponents * mLength, (float*)mData, glUsage));
-	GL_C(glBindBuffer(GL_ARRAY_BUFFER, 0));
-	mBufferObject.second = true; // signify it was properly finished.
+	--mNumAllocations;
+	mRequestedBytes -= allocation.mSize;
+	mBlockBytes -= MIN_BLOCK_SIZE << allocation.mOrder;
+}
 
-	return *this;
-};
+void BufferPool::write(const Allocation& allocation, unsigned int offset, const void* data, unsigned int bytes) {
+	if ((unsigned long long)offset + bytes > allocation.mSize) {
+		printf("the write [%u, %u) is outside of the %u bytes allocated from the buffer pool\n", offset, offset + bytes, allocation.mSize);
+		exit(1);
+	}
 
-void VertexBuffer::dispose() {
-	GL_C(glDeleteBuffers(1, &mBufferObject.first));
-	mBufferObject.second = false;
+	GL_C(glBindBuffer(GL_COPY_WRITE_BUFFER, mArenas[allocation.mArena].mBufferObject));
+	GL_C(glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.mOffset + offset, bytes, data));
+	GL_C(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
 }
 
-IndexBuffer& IndexBuffer::finish() {
-	int glUsage;
+BufferPool::Stats BufferPool::stats() const {
+	Stats stats;
+	stats.mNumArenas = (int)mArenas.size();
+	stats.mNumAllocations = mNumAllocations;
+	stats.mRequestedBytes = mRequestedBytes;
+	stats.mBlockBytes = mBlockBytes;
+
+	for (const Arena& arena : mArenas) {
+		stats.mArenaBytes += arena.mSize;
+		for (size_t iOrder = 0; iOrder < arena.mFreeBlocks.size(); ++iOrder) {
+			size_t blockSize = (size_t)MIN_BLOCK_SIZE << iOrder;
+			stats.mFreeBytes += blockSize * arena.mFreeBlocks[iOrder].size();
+			if (!arena.mFreeBlocks[iOrder].empty() && blockSize > stats.mLargestFreeBlock) {
+				stats.mLargestFreeBlock = blockSize;
+			}
+		}
+	}
+	return stats;
+}
 
-	if (mUsage == "static") {
-		glUsage = GL_STATIC_DRAW;
+void BufferPool::dispose() {
+	for (Arena& arena : mArenas) {
+		context.releaseVertexArrays(arena.mBufferObject);
+		GL_C(glDeleteBuffers(1, &arena.mBufferObject));
 	}
-	else if (mUsage == "dynamic") {
-		glUsage = GL_DYNAMIC_DRAW;
+	mArenas.clear();
+	mNumAllocations = 0;
+	mRequestedBytes = 0;
+	mBlockBytes = 0;
+	mHoldsVertices = false;
+	mHoldsIndices = false;
+}
+
+// the GL usage of a vertex buffer 'usage'.
+inline GLenum VertexBufferUsage(const std::string& usage) {
+	if (usage == "static") {
+		return GL_STATIC_DRAW;
 	}
-	else if (mUsage == "stream") {
-		glUsage = GL_STREAM_DRAW;
+	else if (usage == "dynamic") {
+		return GL_DYNAMIC_DRAW;
+	}
+	else if (usage == "stream") {
+		return GL_STREAM_DRAW;
 	}
 	else {
-		printf("'%s' is not a valid valid of index buffer 'usage'\n", mUsage.c_str());
+		printf("'%s' is not a valid valid of vertex buffer 'usage'\n", usage.c_str());
 		exit(1);
 	}
+}
 
-	if (mLength < 0) {
-		printf("'%d' is not a valid index buffer length\n", mLength);
+#ifndef EMSCRIPTEN
+// persistent mapping is GL 4.4, or ARB_buffer_storage, which the GL 3.3 loader doesn't load.
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+typedef void (APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+#endif
+
+VertexBuffer& VertexBuffer::finish() {
+	GLenum glUsage = VertexBufferUsage(mUsage);
+
+	// 1, 2, 3, 4.
+	if (mNumComponents <= 0 || mNumComponents >= 5) {
+		printf("'%d' is not a valid  number of vertex buffer components\n", mNumComponents);
 		exit(1);
 	}
-	
-	if (mData == nullptr) {
-		printf("Need to specify data for index buffer\n");
+
+	int componentSize;
+	if (mType == "float") {
+		mGlType = GL_FLOAT;
+		componentSize = 4;
+	} else if (mType == "half") {
+		mGlType = GL_HALF_FLOAT;
+		componentSize = 2;
+	} else if (mType == "int8") {
+		mGlType = GL_BYTE;
+		componentSize = 1;
+	} else if (mType == "uint8") {
+		mGlType = GL_UNSIGNED_BYTE;
+		componentSize = 1;
+	} else if (mType == "int16") {
+		mGlType = GL_SHORT;
+		componentSize = 2;
+	} else if (mType == "uint16") {
+		mGlType = GL_UNSIGNED_SHORT;
+		componentSize = 2;
+	} else if (mType == "int_10_10_10_2" || mType == "uint_10_10_10_2") {
+		mGlType = mType == "int_10_10_10_2" ? GL_INT_2_10_10_10_REV : GL_UNSIGNED_INT_2_10_10_10_REV;
+		if (mNumComponents != 4) {
+			printf("a vertex buffer of type '%s' must have 4 components\n", mType.c_str());
+			exit(1);
+		}
+		// the whole element is one component.
+		componentSize = 1;
+	} else {
+		printf("'%s' is not a valid vertex buffer type\n", mType.c_str());
 		exit(1);
 	}
-	
-	GL_C(glGenBuffers(1, &mBufferObject.first));
-	GL_C(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mBufferObject.first));
-	GL_C(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int) * mLength, (float*)mData, glUsage));
-	GL_C(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
-	mBufferObject.second = true; // signify it was properly finished.
-	
-	return *this;
-};
-
-void IndexBuffer::dispose() {
-	GL_C(glDeleteBuffers(1, &mBufferObject.first));
-	mBufferObject.second = false;
-}
-
-Texture2D& Texture2D::finish() {
+	mElementSize = mGlType == GL_INT_2_10_10_10_REV || mGlType == GL_UNSIGNED_INT_2_10_10_10_REV ? 4 : componentSize * mNumComponents;
 
-	if (mWidth < 0) {
-		printf("'%d' is not a valid texture width\n", mWidth);
+	if (mStride < 0 || (mStride != 0 && mStride < mElementSize)) {
+		printf("'%d' is not a valid vertex buffer stride for elements of %d bytes\n", mStride, mElementSize);
+		exit(1);
+	}
+#ifdef EMSCRIPTEN
+	// WebGL limits the stride of vertex attributes, desktop GL only limits it by GL_MAX_VERTEX_ATTRIB_STRIDE on GL 4.4.
+	if (mStride > 255) {
+		printf("'%d' is not a valid vertex buffer stride, WebGL allows at most 255\n", mStride);
+		exit(1);
+	}
+#endif
+	if (mOffset < 0 || (mStride == 0 && mOffset != 0 && mSource == nullptr)) {
+		printf("'%d' is not a valid vertex buffer offset\n", mOffset);
+		exit(1);
+	}
+	// the element at the offset has to fit in the stride, a view of a source is checked against the stride of the source.
+	if (mSource == nullptr && mStride != 0 && mOffset + mElementSize > mStride) {
+		printf("the elements of %d bytes at offset %d don't fit in the stride %d of the buffer named '%s'\n", mElementSize, mOffset, mStride, mName.c_str());
 		exit(1);
 	}
 
-	if (mHeight < 0) {
-		printf("'%d' is not a valid texture height\n", mHeight);
+	if (mDivisor < 0) {
+		printf("'%d' is not a valid vertex buffer divisor\n", mDivisor);
 		exit(1);
 	}
 
-	
-	auto strToWrap = [](const std::string& str) {
-		if (str == "clamp") {
-			return GL_CLAMP_TO_EDGE;
-		} else if (str == "repeat") {
-			return GL_REPEAT;
-		} else if (str == "mirror") {
-			return GL_MIRRORED_REPEAT;
-		} else {
-			return -1;
+	if (mSource != nullptr) {
+		if (!mSource->mBufferObject.second) {
+			printf("the source of the buffer named '%s' has to be finished first\n", mName.c_str());
+			exit(1);
+		}
+		if (mStreaming || mData != nullptr) {
+			printf("the buffer named '%s' reads the data of its source, so it can't have data of its own\n", mName.c_str());
+			exit(1);
+		}
+		if (mOffset + mElementSize > mSource->vertexStride()) {
+			printf("the elements of the buffer named '%s' don't fit in the elements of its source\n", mName.c_str());
+			exit(1);
 		}
-	};
 
-	int wrapS = strToWrap(mWrapS);
-	if (wrapS == -1) {
-		printf("'%s' is not a valid texture wrap mode\n", mWrapS.c_str());
+		// there is no GL buffer of its own, so finishing it only copies that of the source.
+		mLength = mSource->mLength;
+		mBufferObject = mSource->mBufferObject;
+		return *this;
+	}
+	
+	if (mLength < 0) {
+		printf("'%d' is not a valid vertex buffer length\n", mLength);
 		exit(1);
 	}
 
-	int wrapT = strToWrap(mWrapT);
-	if (wrapS == -1) {
-		printf("'%s' is not a valid texture wrap mode\n", mWrapT.c_str());
+	// the data of buffers that are written with update() is optional.
+	if (mData == nullptr && !mStreaming && glUsage == GL_STATIC_DRAW) {
+		printf("Need to specify data for vertex buffer\n");
 		exit(1);
 	}
 
-	int mag = -1;
-	if (mMag == "nearest") {
-		mag = GL_NEAREST;
-	} else if (mMag == "linear") {
-		mag = GL_LINEAR;
-	} else {
-		printf("'%s' is not a valid texture mag filter\n", mMag.c_str());
-		exit(1);
+	// finishing a buffer again replaces it.
+	if (mBufferObject.second) {
+		dispose();
+	}
+
+	if (mPool != nullptr) {
+		if (mStreaming) {
+			printf("the buffer named '%s' can't be both streaming and in a buffer pool\n", mName.c_str());
+			exit(1);
+		}
+
+#ifdef EMSCRIPTEN
+		if (mPool->mHoldsIndices) {
+			printf("the buffer named '%s' can't be in a buffer pool that holds indices, WebGL doesn't allow it\n", mName.c_str());
+			exit(1);
+		}
+#endif
+		mPool->mHoldsVertices = true;
+
+		// the offset is a multiple of the stride, so that the data starts at a whole vertex of the arena.
+		mAllocation = mPool->allocate(byteSize(), vertexStride());
+		mBufferObject = { mPool->bufferObject(mAllocation), true };
+		if (mData != nullptr) {
+			mPool->write(mAllocation, 0, mData, byteSize());
+		}
+		return *this;
+	}
+
+	GL_C(glGenBuffers(1, &mBufferObject.first));
+	GL_C(glBindBuffer(GL_ARRAY_BUFFER, mBufferObject.first));
+
+	if (mStreaming) {
+		GLsizeiptr size = (GLsizeiptr)byteSize() * NUM_REGIONS;
+
+		mMapped = nullptr;
+#ifndef EMSCRIPTEN
+		BufferStorageProc bufferStorage = (BufferStorageProc)context.fetchBufferStorage();
+		if (bufferStorage != nullptr) {
+			// the regions are written through a mapping that stays valid for the lifetime of the buffer.
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			GL_C(bufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags));
+			GL_C(mMapped = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags));
+		}
+#endif
+		if (mMapped == nullptr) {
+			GL_C(glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW));
+		}
+
+		mRegion = 0;
+		mRegionFrame = context.frameIndex;
+		mRegionReleased = {};
+		++context.numStreamingBuffers;
+
+		mBufferObject.second = true;
+		if (mData != nullptr) {
+			update(0, mData, byteSize());
+		}
+	}
+	else {
+		GL_C(glBufferData(GL_ARRAY_BUFFER, byteSize(), mData, glUsage));
+		mBufferObject.second = true; // signify it was properly finished.
+	}
+
+	GL_C(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+	return *this;
+};
+
+void VertexBuffer::dispose() {
+	// the GL buffer belongs to the source.
+	if (mSource != nullptr) {
+		mBufferObject.second = false;
+		return;
+	}
+
+	// the GL buffer belongs to the pool, and the vertex arrays that use it stay valid.
+	if (mPool != nullptr) {
+		if (mBufferObject.second) {
+			mPool->release(mAllocation);
+		}
+		mBufferObject.second = false;
+		return;
+	}
+
+	if (mBufferObject.second) {
+		context.releaseVertexArrays(mBufferObject.first);
+
+		if (mStreaming) {
+			// the GPU may still read the regions, but deleting a buffer is deferred until it is no longer used.
+			if (mMapped != nullptr) {
+				GL_C(glBindBuffer(GL_ARRAY_BUFFER, mBufferObject.first));
+				GL_C(glUnmapBuffer(GL_ARRAY_BUFFER));
+				GL_C(glBindBuffer(GL_ARRAY_BUFFER, 0));
+				mMapped = nullptr;
+			}
+			--context.numStreamingBuffers;
+		}
+	}
+	GL_C(glDeleteBuffers(1, &mBufferObject.first));
+	mBufferObject.second = false;
+}
+
+void VertexBuffer::update(int offset, const void* data, int bytes) {
+	if (mSource != nullptr) {
+		printf("the buffer named '%s' reads the data of its source, so the source has to be updated instead\n", mName.c_str());
+		exit(1);
+	}
+	if (!mBufferObject.second) {
+		printf("forgot to call '.finish()' on the buffer named '%s'\n", mName.c_str());
+		exit(1);
+	}
+	if (offset < 0 || bytes < 0 || offset + bytes > byteSize()) {
+		printf("the update [%d, %d) is outside of the %d bytes of the buffer named '%s'\n", offset, offset + bytes, byteSize(), mName.c_str());
+		exit(1);
+	}
+	if (bytes == 0) {
+		return;
+	}
+
+	if (mPool != nullptr) {
+		mPool->write(mAllocation, offset, data, bytes);
+		return;
+	}
+
+	GL_C(glBindBuffer(GL_ARRAY_BUFFER, mBufferObject.first));
+
+	if (!mStreaming) {
+		GLenum glUsage = VertexBufferUsage(mUsage);
+		if (offset == 0 && bytes == byteSize() && glUsage != GL_STATIC_DRAW) {
+			GL_C(glBufferData(GL_ARRAY_BUFFER, byteSize(), nullptr, glUsage));
+		}
+		GL_C(glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, data));
+		GL_C(glBindBuffer(GL_ARRAY_BUFFER, 0));
+		return;
+	}
+
+	// the first write of a frame moves on to the next region, which was last read NUM_REGIONS - 1 updates ago.
+	if (mRegionFrame != context.frameIndex) {
+		mRegionReleased[mRegion] = context.frameIndex;
+		mRegion = (mRegion + 1) % NUM_REGIONS;
+		mRegionFrame = context.frameIndex;
+		context.waitForFrame(mRegionReleased[mRegion]);
+	}
+
+	GLintptr start = (GLintptr)regionOffset() + offset;
+	if (mMapped != nullptr) {
+		memcpy(mMapped + start, data, bytes);
+	}
+	else {
+#ifdef EMSCRIPTEN
+		GL_C(glBufferSubData(GL_ARRAY_BUFFER, start, bytes, data));
+#else
+		// the fence has been waited for, so the range can be written without synchronizing with the GPU.
+		void* dst = nullptr;
+		GL_C(dst = glMapBufferRange(GL_ARRAY_BUFFER, start, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+		memcpy(dst, data, bytes);
+		GL_C(glUnmapBuffer(GL_ARRAY_BUFFER));
+#endif
+	}
+	GL_C(glBindBuffer(GL_ARRAY_BUFFER, 0));
+}
+
+void* reglCppContext::fetchBufferStorage() {
+	if (bufferStorage.second) {
+		return bufferStorage.first;
+	}
+	bufferStorage.second = true;
+
+#ifndef EMSCRIPTEN
+	GLint major = 0;
+	GLint minor = 0;
+	GL_C(glGetIntegerv(GL_MAJOR_VERSION, &major));
+	GL_C(glGetIntegerv(GL_MINOR_VERSION, &minor));
+	if (major > 4 || (major == 4 && minor >= 4)) {
+		bufferStorage.first = (void*)glfwGetProcAddress("glBufferStorage");
+	}
+	else if (glfwExtensionSupported("GL_ARB_buffer_storage")) {
+		bufferStorage.first = (void*)glfwGetProcAddress("glBufferStorage");
+	}
+#endif
+	return bufferStorage.first;
+}
+
+void reglCppContext::waitForFrame(unsigned long long frame) {
+	if (frame == 0) {
+		return;
+	}
+
+#ifdef EMSCRIPTEN
+	// WebGL buffers are only written with glBufferSubData, which the browser synchronizes itself.
+#else
+	// the oldest fence that is at least as new as 'frame'.
+	const FrameFence* fence = nullptr;
+	for (const FrameFence& frameFence : frameFences) {
+		if (frameFence.mSync != nullptr && frameFence.mFrame >= frame && (fence == nullptr || frameFence.mFrame < fence->mFrame)) {
+			fence = &frameFence;
+		}
+	}
+
+	if (fence == nullptr) {
+		// the frame has not ended yet.
+		++stats.mStreamingWaits;
+		GL_C(glFinish());
+		return;
+	}
+
+	GLenum result;
+	GL_C(result = glClientWaitSync((GLsync)fence->mSync, 0, 0));
+	if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) {
+		return;
+	}
+
+	++stats.mStreamingWaits;
+	do {
+		GL_C(result = glClientWaitSync((GLsync)fence->mSync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000));
+	} while (result == GL_TIMEOUT_EXPIRED);
+#endif
+}
+
+IndexBuffer& IndexBuffer::finish() {
+	int glUsage;
+
+	if (mUsage == "static") {
+		glUsage = GL_STATIC_DRAW;
+	}
+	else if (mUsage == "dynamic") {
+		glUsage = GL_DYNAMIC_DRAW;
+	}
+	else if (mUsage == "stream") {
+		glUsage = GL_STREAM_DRAW;
+	}
+	else {
+		printf("'%s' is not a valid valid of index buffer 'usage'\n", mUsage.c_str());
+		exit(1);
+	}
+
+	if (mLength < 0) {
+		printf("'%d' is not a valid index buffer length\n", mLength);
+		exit(1);
+	}
+	
+	if (mData == nullptr) {
+		printf("Need to specify data for index buffer\n");
+		exit(1);
+	}
+
+	if (mType == "uint8") {
+		mGlType = GL_UNSIGNED_BYTE;
+		mIndexSize = 1;
+	} else if (mType == "uint16") {
+		mGlType = GL_UNSIGNED_SHORT;
+		mIndexSize = 2;
+	} else if (mType == "uint32") {
+		mGlType = GL_UNSIGNED_INT;
+		mIndexSize = 4;
+	} else {
+		printf("'%s' is not a valid index buffer type\n", mType.c_str());
+		exit(1);
+	}
+
+	const void* data = mData;
+	std::vector<unsigned short> narrowed;
+	if (mNarrow && mGlType == GL_UNSIGNED_INT) {
+		const unsigned int* indices = (const unsigned int*)mData;
+		unsigned int maxIndex = 0;
+		for (int iIndex = 0; iIndex < mLength; ++iIndex) {
+			maxIndex = indices[iIndex] > maxIndex ? indices[iIndex] : maxIndex;
+		}
+
+		if (maxIndex <= 0xFFFF) {
+			narrowed.assign(indices, indices + mLength);
+			data = narrowed.data();
+			mGlType = GL_UNSIGNED_SHORT;
+			mIndexSize = 2;
+		}
+	}
+	
+	if (mBufferObject.second) {
+		dispose();
+	}
+
+	if (mPool != nullptr) {
+#ifdef EMSCRIPTEN
+		if (mPool->mHoldsVertices) {
+			printf("the buffer named '%s' can't be in a buffer pool that holds vertices, WebGL doesn't allow it\n", mName.c_str());
+			exit(1);
+		}
+#endif
+		mPool->mHoldsIndices = true;
+
+		mAllocation = mPool->allocate(mIndexSize * mLength, mIndexSize);
+		mBufferObject = { mPool->bufferObject(mAllocation), true };
+		mPool->write(mAllocation, 0, data, mIndexSize * mLength);
+		return *this;
+	}
+
+	// the element array buffer binding belongs to the bound vertex array, so bind one that has no index buffer, 
+	// to not change any of the cached vertex arrays.
+	context.bindVertexArray(nullptr, 0, nullptr);
+
+	GL_C(glGenBuffers(1, &mBufferObject.first));
+	GL_C(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mBufferObject.first));
+	GL_C(glBufferData(GL_ELEMENT_ARRAY_BUFFER, mIndexSize * mLength, data, glUsage));
+	GL_C(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+	mBufferObject.second = true; // signify it was properly finished.
+	
+	return *this;
+};
+
+void IndexBuffer::dispose() {
+	if (mPool != nullptr) {
+		if (mBufferObject.second) {
+			mPool->release(mAllocation);
+		}
+		mBufferObject.second = false;
+		return;
+	}
+
+	if (mBufferObject.second) {
+		context.releaseVertexArrays(mBufferObject.first);
+	}
+	GL_C(glDeleteBuffers(1, &mBufferObject.first));
+	mBufferObject.second = false;
+}
+
+Texture2D& Texture2D::finish() {
+
+	if (mWidth < 0) {
+		printf("'%d' is not a valid texture width\n", mWidth);
+		exit(1);
+	}
+
+	if (mHeight < 0) {
+		printf("'%d' is not a valid texture height\n", mHeight);
+		exit(1);
+	}
+
+	
+	auto strToWrap = [](const std::string& str) {
+		if (str == "clamp") {
+			return GL_CLAMP_TO_EDGE;
+		} else if (str == "repeat") {
+			return GL_REPEAT;
+		} else if (str == "mirror") {
+			return GL_MIRRORED_REPEAT;
+		} else {
+			return -1;
+		}
+	};
+
+	int wrapS = strToWrap(mWrapS);
+	if (wrapS == -1) {
+		printf("'%s' is not a valid texture wrap mode\n", mWrapS.c_str());
+		exit(1);
+	}
+
+	int wrapT = strToWrap(mWrapT);
+	if (wrapS == -1) {
+		printf("'%s' is not a valid texture wrap mode\n", mWrapT.c_str());
+		exit(1);
+	}
+
+	int mag = -1;
+	if (mMag == "nearest") {
+		mag = GL_NEAREST;
+	} else if (mMag == "linear") {
+		mag = GL_LINEAR;
+	} else {
+		printf("'%s' is not a valid texture mag filter\n", mMag.c_str());
+		exit(1);
 	}
 
 	int min = -1;
@@ -254,6 +1115,8 @@ Texture2D& Texture2D::finish() {
 	}
 
 	GL_C(glGenTextures(1, &mTexture.first));
+	// this replaces the texture on the active unit.
+	context.releaseTexture(mTexture.first);
 	GL_C(glBindTexture(GL_TEXTURE_2D, mTexture.first));
 	
 	if (mPixelFormat == "rgba8") {
@@ -286,6 +1149,9 @@ Texture2D& Texture2D::finish() {
 }
 
 void Texture2D::dispose() {
+	if (mTexture.second) {
+		context.releaseTexture(mTexture.first);
+	}
 	GL_C(glDeleteTextures(1, &mTexture.first));
 	mTexture.second = false;
 }
@@ -299,7 +1165,8 @@ inline char* GetShaderLogInfo(GLuint shader) {
 	return infoLog;
 }
 
-inline GLuint CreateShaderFromString(const std::string& shaderSource, const GLenum shaderType) {
+// starts compiling the shader. its status is only checked by FinishProgram(), so that the driver may compile it in the background.
+inline GLuint StartShader(const std::string& shaderSource, const GLenum shaderType) {
 	GLuint shader;
 
 	GL_C(shader = glCreateShader(shaderType));
@@ -307,20 +1174,28 @@ inline GLuint CreateShaderFromString(const std::string& shaderSource, const GLen
 	GL_C(glShaderSource(shader, 1, &c_str, NULL));
 	GL_C(glCompileShader(shader));
 
-	GLint compileStatus;
-	GL_C(glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus));
-	if (compileStatus != GL_TRUE) {
-		LOGI("Could not compile shader\n\n%s \n\n%s\n", shaderSource.c_str(),
-			GetShaderLogInfo(shader));
-		exit(1);
-	}
-
 	return shader;
 }
 
-inline GLuint LoadNormalShader(const std::string& vsSource, const std::string& fsShader) {
+// whether the shader starts with its own '#version' directive.
+inline bool HasVersionDirective(const std::string& source) {
+	size_t begin = source.find_first_not_of(" \t\r\n");
+	return begin != std::string::npos && source.compare(begin, 8, "#version") == 0;
+}
 
-	bool useGl3 = true;// just hardcode this for now.
+// shaders are GLSL 100, unless they specify their own version, like '#version 330 core', which is needed for uniform blocks.
+// the defines are inserted after the '#version' directive, since nothing may come before it.
+inline std::string VersionedSource(const std::string& source, unsigned long long defines) {
+	if (HasVersionDirective(source)) {
+		if (defines == 0) {
+			return source;
+		}
+		size_t lineEnd = source.find('\n', source.find("#version"));
+		if (lineEnd == std::string::npos) {
+			return source + "\n" + DefineLines(defines);
+		}
+		return source.substr(0, lineEnd + 1) + DefineLines(defines) + source.substr(lineEnd + 1);
+	}
 
 	std::string prefix = "";
 
@@ -330,14 +1205,57 @@ inline GLuint LoadNormalShader(const std::string& vsSource, const std::string& f
 
 )");
 
-	GLuint vs = CreateShaderFromString(prefix + vsSource, GL_VERTEX_SHADER);
-	GLuint fs = CreateShaderFromString(prefix + fsShader, GL_FRAGMENT_SHADER);
+	return prefix + DefineLines(defines) + source;
+}
+
+#ifndef EMSCRIPTEN
+// program binaries are GL 4.1, or ARB_get_program_binary, which the GL 3.3 loader doesn't load. 
+// so they are loaded by reglCppContext::programBinaryCache(), and are nullptr if unsupported.
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+static ProgramParameteriProc programParameteri = nullptr;
+static GetProgramBinaryProc getProgramBinary = nullptr;
+static ProgramBinaryProc programBinary = nullptr;
+
+// KHR_parallel_shader_compile, and the ARB version of it, which has the same enum.
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+#endif
 
+// starts linking the program, without waiting for the shaders to compile.
+// if 'retrievable' is true, the driver is asked to keep the binary of the program, so it can be stored by the binary cache.
+inline GLuint StartProgram(GLuint vs, GLuint fs, bool retrievable) {
 	GLuint shader = glCreateProgram();
 	glAttachShader(shader, vs);
 	glAttachShader(shader, fs);
+#ifndef EMSCRIPTEN
+	if (retrievable) {
+		GL_C(programParameteri(shader, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+	}
+#endif
 	glLinkProgram(shader);
 
+	return shader;
+}
+
+// waits for the program to be linked, and exits if it failed. the shaders are deleted.
+inline void FinishProgram(GLuint shader, GLuint vs, GLuint fs, const std::string& vsSource, const std::string& fsSource, unsigned long long defines) {
+	GLuint shaders[] = { vs, fs };
+	const std::string* sources[] = { &vsSource, &fsSource };
+	for (int iShader = 0; iShader < 2; ++iShader) {
+		GLint compileStatus;
+		GL_C(glGetShaderiv(shaders[iShader], GL_COMPILE_STATUS, &compileStatus));
+		if (compileStatus != GL_TRUE) {
+			LOGI("Could not compile shader\n\n%s \n\n%s\n", VersionedSource(*sources[iShader], defines).c_str(),
+				GetShaderLogInfo(shaders[iShader]));
+			exit(1);
+		}
+	}
+
 	GLint Result;
 	glGetProgramiv(shader, GL_LINK_STATUS, &Result);
 	if (Result == GL_FALSE) {
@@ -350,46 +1268,373 @@ inline GLuint LoadNormalShader(const std::string& vsSource, const std::string& f
 
 	glDeleteShader(vs);
 	glDeleteShader(fs);
-
-	return shader;
 }
 
-reglCppContext::ProgramInfo reglCppContext::fetchProgram(const std::string& vert, const std::string& frag){
-	std::string key = vert + frag;
-	
-	if (programCache.count(key) != 0) {
-		return programCache[key];
+// the key of the program made from two shaders and a set of defines, which is never 0.
+inline unsigned long long ProgramKey(unsigned long long vertHash, unsigned long long fragHash, unsigned long long defines = 0) {
+	unsigned long long key = vertHash ^ (fragHash + 0x9e3779b97f4a7c15ull + (vertHash << 6) + (vertHash >> 2));
+	if (defines != 0) {
+		key ^= defines + 0x9e3779b97f4a7c15ull + (key << 6) + (key >> 2);
 	}
+	return key != 0 ? key : 1;
+}
+
+inline double Seconds() {
+	return std::chrono::duration<double>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+}
 
-	ProgramInfo programInfo;
+void reglCppContext::programBinaryCache(const std::string& directory) {
+#ifdef EMSCRIPTEN
+	// WebGL has no program binaries.
+#else
+	programParameteri = (ProgramParameteriProc)glfwGetProcAddress("glProgramParameteri");
+	getProgramBinary = (GetProgramBinaryProc)glfwGetProcAddress("glGetProgramBinary");
+	programBinary = (ProgramBinaryProc)glfwGetProcAddress("glProgramBinary");
 
-	programInfo.mProgram = LoadNormalShader(vert, frag);
-	programInfo.mVert = vert;
-	programInfo.mFrag = frag;
+	int numFormats = 0;
+	if (programParameteri != nullptr && getProgramBinary != nullptr && programBinary != nullptr) {
+		GL_C(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats));
+	}
+	if (numFormats == 0) {
+		printf("program binaries are not supported by the driver, so programs will always be compiled\n");
+		programBinaryDirectory = "";
+		return;
+	}
 
-	// get all attribs:
-	{
-		int count = 0;
-		glGetProgramiv(programInfo.mProgram, GL_ACTIVE_ATTRIBUTES, &count);
-		
-		constexpr int SIZE = 256;
-		char buf[SIZE];
-		
-		for (int ii = 0; ii < count; ii++)
-		{
-			int length = 0;
-			int size = 0;
-			unsigned int type = 0;
+	// binaries are only valid for the driver that created them.
+	std::string driver;
+	driver += (const char*)glGetString(GL_VENDOR);
+	driver += (const char*)glGetString(GL_RENDERER);
+	driver += (const char*)glGetString(GL_VERSION);
+	driverHash = shaderHash(driver);
 
-			glGetActiveAttrib(programInfo.mProgram, (GLuint)ii, SIZE, &length, &size, &type, buf);
+	programBinaryDirectory = directory;
+#endif
+}
 
-			std::string nameStr(buf, length);
+// the header of a file in the program binary cache, which is followed by the binary.
+struct ProgramBinaryHeader {
+	unsigned int mMagic;
+	unsigned long long mKey; // the key the file is named after, to detect files that were overwritten or truncated.
+	unsigned int mFormat;
+	unsigned int mLength;
+	double mCompileTime; // the seconds it took to compile and link the program, when it was stored.
+};
 
-			//printf("Attribute #%d Type: %u Name: %s\n", i, type, name);
-			int attribLocation = 0;
-			GL_C(attribLocation = glGetAttribLocation(programInfo.mProgram, nameStr.c_str()));
+static const unsigned int PROGRAM_BINARY_MAGIC = 0x42475052; // 'RPGB'
 
-			programInfo.mAttributes[nameStr] = attribLocation;
+std::string reglCppContext::programBinaryPath(const ProgramInfo& programInfo) const {
+	char fileName[32];
+	snprintf(fileName, sizeof(fileName), "%016llx.bin", programInfo.mBinaryKey);
+	return programBinaryDirectory + "/" + fileName;
+}
+
+void reglCppContext::beginProgram(ProgramInfo& programInfo) {
+	programInfo.mPending = true;
+
+	std::string vertSource = VersionedSource(programInfo.mVert, programInfo.mDefines);
+	std::string fragSource = VersionedSource(programInfo.mFrag, programInfo.mDefines);
+
+#ifndef EMSCRIPTEN
+	if (!programBinaryDirectory.empty()) {
+		double loadStart = Seconds();
+		// mKey depends on the order that the defines were first seen in, so the sources that are compiled are hashed instead.
+		programInfo.mBinaryKey = ProgramKey(ProgramKey(shaderHash(vertSource), shaderHash(fragSource)), driverHash);
+
+		FILE* file = fopen(programBinaryPath(programInfo).c_str(), "rb");
+		if (file != nullptr) {
+			ProgramBinaryHeader header;
+			std::vector<unsigned char> binary;
+			bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.mMagic == PROGRAM_BINARY_MAGIC && header.mKey == programInfo.mBinaryKey;
+			if (valid) {
+				binary.resize(header.mLength);
+				valid = fread(binary.data(), 1, header.mLength, file) == header.mLength;
+			}
+			fclose(file);
+
+			// the driver may still reject the binary, e.g. after a driver update that kept the version string.
+			if (valid) {
+				GLuint program = glCreateProgram();
+				// not checked with GL_C, since an unknown format is an expected error here.
+				programBinary(program, header.mFormat, binary.data(), (GLsizei)binary.size());
+				GLint linkStatus = GL_FALSE;
+				glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+				if (linkStatus == GL_TRUE) {
+					++stats.mProgramBinaryHits;
+					stats.mProgramBinaryTimeSaved += header.mCompileTime - (Seconds() - loadStart);
+					programInfo.mProgram = program;
+					return;
+				}
+				GL_C(glDeleteProgram(program));
+				while (glGetError() != GL_NO_ERROR) {}
+			}
+		}
+		++stats.mProgramBinaryMisses;
+	}
+#endif
+
+	programInfo.mCompileStart = Seconds();
+	programInfo.mVertexShader = StartShader(vertSource, GL_VERTEX_SHADER);
+	programInfo.mFragmentShader = StartShader(fragSource, GL_FRAGMENT_SHADER);
+	programInfo.mProgram = StartProgram(programInfo.mVertexShader, programInfo.mFragmentShader, !programBinaryDirectory.empty());
+}
+
+bool reglCppContext::programCompleted(const ProgramInfo& programInfo) {
+	if (!programInfo.mPending || programInfo.mVertexShader == 0) {
+		return true;
+	}
+#ifndef EMSCRIPTEN
+	if (parallelShaderCompile.first) {
+		GLint completed = GL_FALSE;
+		GL_C(glGetProgramiv(programInfo.mProgram, GL_COMPLETION_STATUS_KHR, &completed));
+		return completed == GL_TRUE;
+	}
+#endif
+	// without KHR_parallel_shader_compile, there is no way to ask without waiting.
+	return true;
+}
+
+void reglCppContext::endProgram(ProgramInfo& programInfo) {
+	if (!programInfo.mPending) {
+		return;
+	}
+
+	// loaded from the binary cache, so there are no shaders.
+	if (programInfo.mVertexShader != 0) {
+		FinishProgram(programInfo.mProgram, programInfo.mVertexShader, programInfo.mFragmentShader, programInfo.mVert, programInfo.mFrag, programInfo.mDefines);
+		programInfo.mVertexShader = 0;
+		programInfo.mFragmentShader = 0;
+
+#ifndef EMSCRIPTEN
+		if (!programBinaryDirectory.empty()) {
+			storeProgramBinary(programInfo);
+		}
+#endif
+	}
+
+	reflectProgram(programInfo);
+	programInfo.mPending = false;
+}
+
+void reglCppContext::storeProgramBinary(const ProgramInfo& programInfo) {
+#ifndef EMSCRIPTEN
+	// for a precompiled program, this is the time until its first use, so it may be more than the actual compile time.
+	ProgramBinaryHeader header;
+	header.mMagic = PROGRAM_BINARY_MAGIC;
+	header.mKey = programInfo.mBinaryKey;
+	header.mCompileTime = Seconds() - programInfo.mCompileStart;
+
+	GLint length = 0;
+	GL_C(glGetProgramiv(programInfo.mProgram, GL_PROGRAM_BINARY_LENGTH, &length));
+	if (length <= 0) {
+		return;
+	}
+	std::vector<unsigned char> binary(length);
+	GLenum format = 0;
+	GL_C(getProgramBinary(programInfo.mProgram, length, &length, &format, binary.data()));
+	header.mFormat = format;
+	header.mLength = (unsigned int)length;
+
+	std::string path = programBinaryPath(programInfo);
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		printf("could not write the program binary '%s'\n", path.c_str());
+		return;
+	}
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(binary.data(), 1, header.mLength, file);
+	fclose(file);
+#endif
+}
+
+reglCppContext::ProgramInfo* reglCppContext::findProgram(unsigned long long key) {
+	if (programTable.empty()) {
+		return nullptr;
+	}
+
+	size_t mask = programTable.size() - 1;
+	for (size_t iSlot = (size_t)key & mask; programTable[iSlot].mKey != 0; iSlot = (iSlot + 1) & mask) {
+		if (programTable[iSlot].mKey == key) {
+			return programTable[iSlot].mProgram;
+		}
+	}
+	return nullptr;
+}
+
+reglCppContext::ProgramInfo& reglCppContext::createProgram(
+	unsigned long long key, unsigned long long vertHash, unsigned long long fragHash, 
+	const std::string& vert, const std::string& frag, unsigned long long defines) {
+#ifndef NDEBUG
+	// the sources are only hashed again here, once per program, so that a cache hit never depends on their length.
+	if (shaderHash(vert) != vertHash || shaderHash(frag) != fragHash) {
+		printf("a Command's shader was changed without vert() or frag()\n");
+		exit(1);
+	}
+#endif
+
+	programCache.push_back(ProgramInfo());
+	ProgramInfo& programInfo = programCache.back();
+
+	programInfo.mKey = key;
+	programInfo.mVertHash = vertHash;
+	programInfo.mFragHash = fragHash;
+	programInfo.mVert = vert;
+	programInfo.mFrag = frag;
+	programInfo.mDefines = defines;
+	beginProgram(programInfo);
+
+	programsById[programInfo.mProgram] = &programInfo;
+
+	// grow the table when it is half full, so that the probe sequences stay short.
+	if (programCache.size() * 2 > programTable.size()) {
+		std::vector<ProgramSlot> oldTable;
+		oldTable.swap(programTable);
+		programTable.assign(std::max((size_t)64, oldTable.size() * 2), { 0, nullptr });
+
+		for (const ProgramSlot& slot : oldTable) {
+			if (slot.mKey != 0) {
+				insertProgramSlot(slot);
+			}
+		}
+	}
+	insertProgramSlot({ key, &programInfo });
+
+	return programInfo;
+}
+
+void reglCppContext::insertProgramSlot(const ProgramSlot& slot) {
+	size_t mask = programTable.size() - 1;
+	size_t iSlot = (size_t)slot.mKey & mask;
+	while (programTable[iSlot].mKey != 0) {
+		iSlot = (iSlot + 1) & mask;
+	}
+	programTable[iSlot] = slot;
+}
+
+const reglCppContext::ProgramInfo& reglCppContext::fetchProgram(
+	unsigned long long vertHash, unsigned long long fragHash, const std::string& vert, const std::string& frag, 
+	unsigned long long defines, bool allowFallback) {
+	unsigned long long key = ProgramKey(vertHash, fragHash, defines);
+
+	ProgramInfo* programInfo = findProgram(key);
+	if (programInfo == nullptr) {
+		programInfo = &createProgram(key, vertHash, fragHash, vert, frag, defines);
+	}
+#ifndef NDEBUG
+	// the key combines the hashes, so comparing them separately catches two programs whose keys collide.
+	else if (programInfo->mVertHash != vertHash || programInfo->mFragHash != fragHash || programInfo->mDefines != defines) {
+		printf("two different programs have the same key\n");
+		exit(1);
+	}
+#endif
+
+	if (programInfo->mPending) {
+		if (allowFallback && fallback != nullptr && !programCompleted(*programInfo)) {
+			++stats.mProgramFallbacks;
+			return *fallback;
+		}
+		endProgram(*programInfo);
+	}
+
+	return *programInfo;
+}
+
+void reglCppContext::enableParallelShaderCompile() {
+	if (parallelShaderCompile.second) {
+		return;
+	}
+	parallelShaderCompile.second = true;
+
+#ifndef EMSCRIPTEN
+	const char* extensions[][2] = {
+		{ "GL_KHR_parallel_shader_compile", "glMaxShaderCompilerThreadsKHR" },
+		{ "GL_ARB_parallel_shader_compile", "glMaxShaderCompilerThreadsARB" },
+	};
+	for (const auto& extension : extensions) {
+		if (!glfwExtensionSupported(extension[0])) {
+			continue;
+		}
+		MaxShaderCompilerThreadsProc maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress(extension[1]);
+		if (maxShaderCompilerThreads != nullptr) {
+			// let the driver use as many threads as it likes.
+			GL_C(maxShaderCompilerThreads(0xFFFFFFFF));
+		}
+		parallelShaderCompile.first = true;
+		break;
+	}
+#endif
+}
+
+void reglCppContext::precompile(const std::vector<std::pair<std::string, std::string>>& programs) {
+	// a single variant without any defines.
+	precompile(programs, std::vector<std::vector<std::string>>(1));
+}
+
+void reglCppContext::precompile(
+	const std::vector<std::pair<std::string, std::string>>& programs, const std::vector<std::vector<std::string>>& variants) {
+	enableParallelShaderCompile();
+
+	for (const std::pair<std::string, std::string>& program : programs) {
+		unsigned long long vertHash = shaderHash(program.first);
+		unsigned long long fragHash = shaderHash(program.second);
+
+		for (const std::vector<std::string>& variant : variants) {
+			unsigned long long defines = 0;
+			for (const std::string& define : variant) {
+				defines |= defineBit(define);
+			}
+
+			unsigned long long key = ProgramKey(vertHash, fragHash, defines);
+			if (findProgram(key) == nullptr) {
+				createProgram(key, vertHash, fragHash, program.first, program.second, defines);
+			}
+		}
+	}
+}
+
+bool reglCppContext::programsReady() {
+	bool ready = true;
+	for (ProgramInfo& programInfo : programCache) {
+		if (!programInfo.mPending) {
+			continue;
+		}
+		if (programCompleted(programInfo)) {
+			endProgram(programInfo);
+		} else {
+			ready = false;
+		}
+	}
+	return ready;
+}
+
+void reglCppContext::fallbackProgram(const std::string& vert, const std::string& frag) {
+	fallback = &fetchProgram(shaderHash(vert), shaderHash(frag), vert, frag, 0, false);
+}
+
+void reglCppContext::reflectProgram(ProgramInfo& programInfo) {
+	// get all attribs:
+	{
+		int count = 0;
+		glGetProgramiv(programInfo.mProgram, GL_ACTIVE_ATTRIBUTES, &count);
+		
+		constexpr int SIZE = 256;
+		char buf[SIZE];
+		
+		for (int ii = 0; ii < count; ii++)
+		{
+			int length = 0;
+			int size = 0;
+			unsigned int type = 0;
+
+			glGetActiveAttrib(programInfo.mProgram, (GLuint)ii, SIZE, &length, &size, &type, buf);
+
+			std::string nameStr(buf, length);
+
+			//printf("Attribute #%d Type: %u Name: %s\n", i, type, name);
+			int attribLocation = 0;
+			GL_C(attribLocation = glGetAttribLocation(programInfo.mProgram, nameStr.c_str()));
+
+			programInfo.mAttributes.push_back({ internSymbol(nameStr), attribLocation });
 		}
 	}
 
@@ -415,15 +1660,142 @@ reglCppContext::ProgramInfo reglCppContext::fetchProgram(const std::string& vert
 			int uniformLocation = 0;
 			GL_C(uniformLocation = glGetUniformLocation(programInfo.mProgram, nameStr.c_str()));
 
-			programInfo.mUniforms[nameStr] = uniformLocation;
+			// members of uniform blocks have no location.
+			if (uniformLocation == -1) {
+				continue;
+			}
+
+			programInfo.mUniforms.push_back({ internSymbol(nameStr), uniformLocation });
 		}
 	}
-	return programInfo;
+
+	// get all uniform blocks, and the layout of their members:
+	{
+		int count = 0;
+		GL_C(glGetProgramiv(programInfo.mProgram, GL_ACTIVE_UNIFORM_BLOCKS, &count));
+
+		constexpr int SIZE = 256;
+		char buf[SIZE];
+
+		for (int ii = 0; ii < count; ii++)
+		{
+			int length = 0;
+			GL_C(glGetActiveUniformBlockName(programInfo.mProgram, (GLuint)ii, SIZE, &length, buf));
+
+			int dataSize = 0;
+			int numMembers = 0;
+			GL_C(glGetActiveUniformBlockiv(programInfo.mProgram, (GLuint)ii, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize));
+			GL_C(glGetActiveUniformBlockiv(programInfo.mProgram, (GLuint)ii, GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS, &numMembers));
+
+			std::vector<GLint> memberIndices(numMembers);
+			std::vector<GLint> memberOffsets(numMembers);
+			std::vector<GLint> memberMatrixStrides(numMembers);
+			if (numMembers > 0) {
+				GL_C(glGetActiveUniformBlockiv(programInfo.mProgram, (GLuint)ii, GL_UNIFORM_BLOCK_ACTIVE_UNIFORM_INDICES, memberIndices.data()));
+				GL_C(glGetActiveUniformsiv(programInfo.mProgram, numMembers, (const GLuint*)memberIndices.data(), GL_UNIFORM_OFFSET, memberOffsets.data()));
+				GL_C(glGetActiveUniformsiv(programInfo.mProgram, numMembers, (const GLuint*)memberIndices.data(), GL_UNIFORM_MATRIX_STRIDE, memberMatrixStrides.data()));
+			}
+
+			unsigned int binding = fetchBlockBinding(internSymbol(std::string(buf, length)));
+			GL_C(glUniformBlockBinding(programInfo.mProgram, (GLuint)ii, binding));
+
+			int iBlock = (int)programInfo.mBlocks.size();
+			programInfo.mBlocks.push_back({ binding, dataSize });
+
+			for (int iMember = 0; iMember < numMembers; ++iMember) {
+				int size = 0;
+				unsigned int type = 0;
+				GL_C(glGetActiveUniform(programInfo.mProgram, (GLuint)memberIndices[iMember], SIZE, &length, &size, &type, buf));
+
+				programInfo.mBlockMembers.push_back({ internSymbol(std::string(buf, length)), iBlock, memberOffsets[iMember], memberMatrixStrides[iMember] });
+			}
+		}
+	}
+
+	programInfo.mUniformLocations.assign(numSymbols(), -1);
+	for (const ProgramInfo::ActiveVariable& uniform : programInfo.mUniforms) {
+		programInfo.mUniformLocations[uniform.mSymbol] = uniform.mLocation;
+	}
+}
+
+unsigned int reglCppContext::fetchBlockBinding(unsigned int symbol) {
+	for (size_t iBinding = 0; iBinding < blockBindings.size(); ++iBinding) {
+		if (blockBindings[iBinding] == symbol) {
+			return (unsigned int)iBinding;
+		}
+	}
+
+	int maxBindings = 0;
+	GL_C(glGetIntegerv(GL_MAX_UNIFORM_BUFFER_BINDINGS, &maxBindings));
+	if ((int)blockBindings.size() >= maxBindings) {
+		printf("too many different uniform blocks, at most %d are supported\n", maxBindings);
+		exit(1);
+	}
+
+	blockBindings.push_back(symbol);
+	return (unsigned int)blockBindings.size() - 1;
 }
 
+// writes a uniform value into the std140 data of the uniform block that it is a member of.
+// matrices are column major. textures can't be members of uniform blocks, and are ignored.
+inline void WriteBlockMember(unsigned char* blockData, const DrawCall::BlockMember& member, const UniformValue& value) {
+	unsigned char* dst = blockData + member.mOffset;
+
+	switch (value.mType) {
+	case UniformValue::FLOAT_VEC1: memcpy(dst, value.mFloatVec1.data(), sizeof(float) * 1); break;
+	case UniformValue::FLOAT_VEC2: memcpy(dst, value.mFloatVec2.data(), sizeof(float) * 2); break;
+	case UniformValue::FLOAT_VEC3: memcpy(dst, value.mFloatVec3.data(), sizeof(float) * 3); break;
+	case UniformValue::FLOAT_VEC4: memcpy(dst, value.mFloatVec4.data(), sizeof(float) * 4); break;
+	case UniformValue::FLOAT_MAT4X4:
+		for (int iColumn = 0; iColumn < 4; ++iColumn) {
+			memcpy(dst + iColumn * member.mMatrixStride, value.mFloatMat4x4[iColumn].data(), sizeof(float) * 4);
+		}
+		break;
+	default: break;
+	}
+}
+
+// writes the dynamic uniforms that are block members into 'blockData', which is laid out as 'blocks' describes.
+inline void WriteDynamicBlockMembers(
+	unsigned char* blockData, const DrawCall::BlockBinding* blocks, 
+	const std::vector<DrawCall::BlockMember>& members, const std::vector<Uniform>& dynamicUniforms) {
+	for (const Uniform& uniform : dynamicUniforms) {
+		for (const DrawCall::BlockMember& member : members) {
+			if (member.mSymbol == uniform.mKey.mId) {
+				WriteBlockMember(blockData + blocks[member.mBlock].mOffset, member, uniform.mValue);
+			}
+		}
+	}
+}
 
+// the vertex that all the attributes start at in their pool arenas, or -1 if they are not all pooled, or start at different vertices.
+// per instance attributes are not offset by the base vertex, so they can't be pooled this way.
+inline int PooledBaseVertex(const std::vector<DrawCall::AttributeBinding>& attributes) {
+	int baseVertex = -1;
+	for (const DrawCall::AttributeBinding& attribute : attributes) {
+		int attributeBaseVertex = attribute.mVertexBuffer->pooledBaseVertex();
+		if (attribute.mVertexBuffer->mDivisor != 0 || attributeBaseVertex == -1 ||
+			(baseVertex != -1 && attributeBaseVertex != baseVertex)) {
+			return -1;
+		}
+		baseVertex = attributeBaseVertex;
+	}
+	return baseVertex;
+}
+
+// whether any of the attributes is read from a streaming buffer, whose region changes every frame.
+inline bool UsesStreamingBuffer(const std::vector<DrawCall::AttributeBinding>& attributes) {
+	for (const DrawCall::AttributeBinding& attribute : attributes) {
+		const VertexBuffer* vertexBuffer = attribute.mVertexBuffer->mSource != nullptr ? attribute.mVertexBuffer->mSource : attribute.mVertexBuffer;
+		if (vertexBuffer->mStreaming) {
+			return true;
+		}
+	}
+	return false;
+}
 
-void reglCppContext::submitWithContextState(contextState state) {
+void reglCppContext::compileState(const contextState& state, DrawCall& drawCall, bool allowFallback) {
+	drawCall.mContext = this;
 
 	if (state.mViewport[0] == -1 ||
 		state.mViewport[1] == -1 ||
@@ -432,8 +1804,7 @@ void reglCppContext::submitWithContextState(contextState state) {
 		
 		printf("you need to specify a viewport for your command");
 	}
-	
-	GL_C(glViewport(state.mViewport[0], state.mViewport[1], state.mViewport[2], state.mViewport[3]));
+	drawCall.mViewport = state.mViewport;
 
 	bool doClear = !isnan(state.mClearColor[0]) &&
 		!isnan(state.mClearColor[1]) &&
@@ -441,184 +1812,1311 @@ void reglCppContext::submitWithContextState(contextState state) {
 		!isnan(state.mClearColor[3]);
 
 	doClear = doClear && !isnan(state.mClearDepth);
-	
-	// translate stack state to GL commands. 
-	if (doClear) {
 
+	drawCall.mClear = doClear;
+	drawCall.mClearColor = state.mClearColor;
+	drawCall.mClearDepth = state.mClearDepth;
+
+	drawCall.mOrdered = state.mOrdered;
+
+	drawCall.mDraw = state.mCount != -1;
+	if (!drawCall.mDraw) {
+		return;
+	}
+
+	drawCall.mDepthTest = state.mDepthTest;
+	drawCall.mCount = state.mCount;
+	drawCall.mInstances = state.mInstances;
+	drawCall.mFirst = state.mFirst;
+	drawCall.mBaseVertex = state.mBaseVertex;
+
+	if (state.mFirst < 0) {
+		printf("'%d' is not a valid first index\n", state.mFirst);
+		exit(1);
+	}
 #ifdef EMSCRIPTEN
-		GL_C(glClearDepthf(state.mClearDepth));
-#else
-		GL_C(glClearDepth(state.mClearDepth));
+	if (state.mBaseVertex != 0) {
+		printf("baseVertex() is not supported in WebGL\n");
+		exit(1);
+	}
 #endif
 
-		GL_C(glClearColor(
-			state.mClearColor[0],
-			state.mClearColor[1],
-			state.mClearColor[2],
-			state.mClearColor[3]
-		));
-		
-		GL_C(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+	if (state.mVert == nullptr) {
+		printf("please specify a vertex shader\n");
+		exit(1);
+	}
+	if (state.mFrag == nullptr) {
+		printf("please specify a fragment shader\n");
+		exit(1);
 	}
 
-	//set view port  glViewport.
-
-	if (state.mCount != -1) {
-		if (state.mDepthTest) {
-			GL_C(glEnable(GL_DEPTH_TEST));
+	const ProgramInfo& programInfo = fetchProgram(
+		state.mVertHash, state.mFragHash, *state.mVert, *state.mFrag, state.mDefines, allowFallback);
+	drawCall.mProgram = programInfo.mProgram;
+	drawCall.mUniformLocations = &programInfo.mUniformLocations;
+
+	// lay out the data of the uniform blocks. members that are not set are zero.
+	drawCall.mBlocks.clear();
+	drawCall.mBlockData.clear();
+	for (const ProgramInfo::UniformBlock& block : programInfo.mBlocks) {
+		drawCall.mBlocks.push_back({ block.mBinding, (unsigned int)drawCall.mBlockData.size(), (unsigned int)block.mSize });
+		drawCall.mBlockData.resize(drawCall.mBlockData.size() + block.mSize, 0);
+	}
+	drawCall.mBlockMembers = &programInfo.mBlockMembers;
+	for (const DrawCall::BlockMember& member : programInfo.mBlockMembers) {
+		if (member.mSymbol >= state.mUniforms.size() || state.mUniforms[member.mSymbol] == nullptr) {
+			continue;
 		}
-		else {
-			GL_C(glDisable(GL_DEPTH_TEST));
+		WriteBlockMember(drawCall.mBlockData.data() + drawCall.mBlocks[member.mBlock].mOffset, member, *state.mUniforms[member.mSymbol]);
+	}
+
+	drawCall.mUniforms.clear();
+	for (const ProgramInfo::ActiveVariable& uniform : programInfo.mUniforms) {
+		// the program may have interned symbols that no command has used yet.
+		if (uniform.mSymbol >= state.mUniforms.size() || state.mUniforms[uniform.mSymbol] == nullptr) {
+			continue;
 		}
+		drawCall.mUniforms.push_back({ uniform.mLocation, *state.mUniforms[uniform.mSymbol] });
+	}
 
-		GL_C(glDepthMask(true));
-		GL_C(glDisable(GL_BLEND));
-		GL_C(glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE));
-		GL_C(glEnable(GL_CULL_FACE));
-		GL_C(glFrontFace(GL_CCW));
-		GL_C(glBindFramebuffer(GL_FRAMEBUFFER, 0));
-		GL_C(glDepthFunc(GL_LESS));
-		
-		if (state.mVert.size() == 0) {
-			printf("please specify a vertex shader\n");
+	drawCall.mAttributes.clear();
+	for (const ProgramInfo::ActiveVariable& attribute : programInfo.mAttributes) {
+		VertexBuffer* attributeVertexBuffer = attribute.mSymbol < state.mAttributes.size() ? state.mAttributes[attribute.mSymbol] : nullptr;
+		if (attributeVertexBuffer == nullptr) {
+			printf("no vertex buffer was specified for the attribute '%s'\n", symbolName(attribute.mSymbol).c_str());
 			exit(1);
 		}
-		if (state.mFrag.size() == 0) {
-			printf("please specify a fragment shader\n");
+
+		if (!attributeVertexBuffer->mBufferObject.second) {
+			printf("forgot to call '.finish()' on the buffer named '%s'\n", attributeVertexBuffer->mName.c_str());
 			exit(1);
 		}
 
-		ProgramInfo programInfo = fetchProgram(state.mVert, state.mFrag);
+		drawCall.mAttributes.push_back({ attribute.mLocation, attributeVertexBuffer });
+	}
 
-		GL_C(glUseProgram(programInfo.mProgram));
+	static const std::string noPrimitive = "";
+	const std::string& primitive = state.mPrimitive != nullptr ? *state.mPrimitive : noPrimitive;
+	if (primitive == "triangles") {
+		drawCall.mPrimitive = GL_TRIANGLES;
+	} else if (primitive == "points") {
+		drawCall.mPrimitive = GL_POINTS;
+	} else {
+		printf("'%s' is an unsupported primitive type\n", primitive.c_str());
+		exit(1);
+	}
 
-		int iActiveTexture = 0;
-		for (const auto& pair : state.mUniforms) {
-			std::string uniformName = pair.first;
-			UniformValue uniformValue = pair.second;
+	drawCall.mIndices = state.mIndices;
+	if (state.mIndices != nullptr && !state.mIndices->mBufferObject.second) {
+		printf("forgot to call '.finish()' on the buffer named '%s'\n", state.mIndices->mName.c_str());
+		exit(1);
+	}
 
-			if (programInfo.mUniforms.count(uniformName) == 0) {
-				continue;
-			}
-			unsigned int uniformLocation = programInfo.mUniforms[uniformName];
+	// the indices of a pooled index buffer start after those of the other meshes in the arena.
+	if (state.mIndices != nullptr) {
+		drawCall.mFirst += state.mIndices->firstIndex();
+	}
 
-			if (uniformValue.mType == UniformValue::FLOAT_VEC1) {
-				GL_C(glUniform1f(uniformLocation, uniformValue.mFloatVec1[0]));
-			}
-			else if (uniformValue.mType == UniformValue::FLOAT_VEC2) {
-				GL_C(glUniform2f(uniformLocation, uniformValue.mFloatVec2[0], uniformValue.mFloatVec2[1]));
-			}
-			else if (uniformValue.mType == UniformValue::FLOAT_VEC3) {
-				GL_C(glUniform3f(uniformLocation,
-					uniformValue.mFloatVec3[0],
-					uniformValue.mFloatVec3[1],
-					uniformValue.mFloatVec3[2]));
-			}
-			else if (uniformValue.mType == UniformValue::FLOAT_VEC4) {
-				GL_C(glUniform4f(uniformLocation,
-					uniformValue.mFloatVec4[0],
-					uniformValue.mFloatVec3[1],
-					uniformValue.mFloatVec4[2],
-					uniformValue.mFloatVec4[3]));
-			}
-			else if (uniformValue.mType == UniformValue::FLOAT_MAT4X4) {
-				GL_C(glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, (GLfloat*)& uniformValue.mFloatMat4x4[0]));
-			} else if (uniformValue.mType == UniformValue::TEXTURE2D) {
+	// if all the attributes are pooled, and start at the same vertex of their arenas, they are bound from the start
+	// of the arenas, and the draw starts at that vertex instead. then the draws of all the meshes in the arenas
+	// use the same vertex array, and CommandBuffer::flush() can merge them into multi-draw calls.
+	drawCall.mPooled = false;
+#ifndef EMSCRIPTEN
+	int baseVertex = PooledBaseVertex(drawCall.mAttributes);
+	if (baseVertex != -1) {
+		drawCall.mPooled = true;
+		if (state.mIndices != nullptr) {
+			drawCall.mBaseVertex += baseVertex;
+		} else {
+			drawCall.mFirst += baseVertex;
+		}
+	}
+#endif
 
-				GL_C(glUniform1i(uniformLocation, iActiveTexture));
-				GL_C(glActiveTexture(GL_TEXTURE0 + iActiveTexture));
-				GL_C(glBindTexture(GL_TEXTURE_2D, uniformValue.mTexture2D->mTexture.first));
+	// the vertex array is looked up once here, instead of on every draw.
+	drawCall.mVertexArray = 0;
+	if (!UsesStreamingBuffer(drawCall.mAttributes)) {
+		drawCall.mVertexArray = fetchVertexArray(drawCall.mAttributes.data(), drawCall.mAttributes.size(), drawCall.mIndices, drawCall.mPooled);
+		drawCall.mVertexArrayGeneration = vertexArrayGeneration;
+	}
+}
 
-				++iActiveTexture;
-			}
-		}
-		
-		for (const auto& pair : programInfo.mAttributes) {
-			std::string attributeName = pair.first;
-			unsigned int attributeLocation = pair.second;
+// uploads a single uniform value. textures are bound by reglCppContext::uploadUniform() instead.
+inline void UploadUniform(int uniformLocation, const UniformValue& uniformValue) {
+	if (uniformValue.mType == UniformValue::FLOAT_VEC1) {
+		GL_C(glUniform1f(uniformLocation, uniformValue.mFloatVec1[0]));
+	}
+	else if (uniformValue.mType == UniformValue::FLOAT_VEC2) {
+		GL_C(glUniform2f(uniformLocation, uniformValue.mFloatVec2[0], uniformValue.mFloatVec2[1]));
+	}
+	else if (uniformValue.mType == UniformValue::FLOAT_VEC3) {
+		GL_C(glUniform3f(uniformLocation,
+			uniformValue.mFloatVec3[0],
+			uniformValue.mFloatVec3[1],
+			uniformValue.mFloatVec3[2]));
+	}
+	else if (uniformValue.mType == UniformValue::FLOAT_VEC4) {
+		GL_C(glUniform4f(uniformLocation,
+			uniformValue.mFloatVec4[0],
+			uniformValue.mFloatVec4[1],
+			uniformValue.mFloatVec4[2],
+			uniformValue.mFloatVec4[3]));
+	}
+	else if (uniformValue.mType == UniformValue::FLOAT_MAT4X4) {
+		GL_C(glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, (GLfloat*)& uniformValue.mFloatMat4x4[0]));
+	}
+}
+
+inline bool UniformValuesEqual(const UniformValue& a, const UniformValue& b) {
+	if (a.mType != b.mType) {
+		return false;
+	}
 
-			VertexBuffer* attributeVertexBuffer = state.mAttributes[attributeName];
+	switch (a.mType) {
+	case UniformValue::FLOAT_VEC1: return a.mFloatVec1 == b.mFloatVec1;
+	case UniformValue::FLOAT_VEC2: return a.mFloatVec2 == b.mFloatVec2;
+	case UniformValue::FLOAT_VEC3: return a.mFloatVec3 == b.mFloatVec3;
+	case UniformValue::FLOAT_VEC4: return a.mFloatVec4 == b.mFloatVec4;
+	case UniformValue::FLOAT_MAT4X4: return a.mFloatMat4x4 == b.mFloatMat4x4;
+	case UniformValue::TEXTURE2D: return a.mTexture2D == b.mTexture2D;
+	default: return true;
+	}
+}
 
-			GLenum type = GL_FLOAT;
+// returns true if the GL call that changes 'shadow' to 'value' needs to be issued, and false if GL already has that value.
+template<typename T>
+inline bool UpdateShadowState(std::pair<T, bool>& shadow, const T& value, reglCppContext::Stats& stats) {
+	if (shadow.second && shadow.first == value) {
+		++stats.mStateCallsElided;
+		return false;
+	}
+	shadow.first = value;
+	shadow.second = true;
+	++stats.mStateCallsIssued;
+	return true;
+}
 
-			if (!attributeVertexBuffer->mBufferObject.second) {
-				printf("forgot to call '.finish()' on the buffer named '%s'\n", attributeVertexBuffer->mName.c_str());
-				exit(1);
-			}
-			
-			glBindBuffer(GL_ARRAY_BUFFER, attributeVertexBuffer->mBufferObject.first);
-			
-			GL_C(glVertexAttribPointer(
-				(GLuint)attributeLocation, 
-				attributeVertexBuffer->mNumComponents,
-				type,
-				GL_FALSE, 
-				sizeof(float) * attributeVertexBuffer->mNumComponents,
-				(void*)0));
-			
-			GL_C(glEnableVertexAttribArray((GLuint)attributeLocation));
-			
-		}
-
-		GLenum primitive;
-		if (state.mPrimitive == "triangles") {
-			primitive = GL_TRIANGLES;
-		} else if (state.mPrimitive == "points") {
-			primitive = GL_POINTS;
-		} else {
-			printf("'%s' is an unsupported primitive type\n", state.mPrimitive.c_str());
-			exit(1);
+bool reglCppContext::applyDrawState(const DrawState& state) {
+	if (UpdateShadowState(glState.mViewport, state.mViewport, stats)) {
+		GL_C(glViewport(state.mViewport[0], state.mViewport[1], state.mViewport[2], state.mViewport[3]));
+	}
+
+	if (state.mClear) {
 
+		if (UpdateShadowState(glState.mClearDepth, state.mClearDepth, stats)) {
+#ifdef EMSCRIPTEN
+			GL_C(glClearDepthf(state.mClearDepth));
+#else
+			GL_C(glClearDepth(state.mClearDepth));
+#endif
 		}
 
-		if (state.mIndices != nullptr) {
-			if (!state.mIndices->mBufferObject.second) {
-				printf("forgot to call '.finish()' on the buffer named '%s'\n", state.mIndices->mName.c_str());
-				exit(1);
-			}
-			
-			GL_C(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state.mIndices->mBufferObject.first));
-			GL_C(glDrawElements(primitive, state.mCount, GL_UNSIGNED_INT, 0));
+		if (UpdateShadowState(glState.mClearColor, state.mClearColor, stats)) {
+			GL_C(glClearColor(
+				state.mClearColor[0],
+				state.mClearColor[1],
+				state.mClearColor[2],
+				state.mClearColor[3]
+			));
+		}
 
+		// glClear writes through the color and depth masks, so make sure they are enabled.
+		if (UpdateShadowState(glState.mDepthMask, true, stats)) {
+			GL_C(glDepthMask(GL_TRUE));
 		}
-		else {
-			// TODO: handle other things than triangles as well.
-			GL_C(glDrawArrays(primitive, 0, state.mCount));
+		if (UpdateShadowState(glState.mColorMask, { { true, true, true, true } }, stats)) {
+			GL_C(glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE));
 		}
-	
-		//now bind index buffer. and then draw.
-		//also, handle rendering without index buffer.
+		
+		GL_C(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+	}
 
+	if (!state.mDraw) {
+		return false;
+	}
 
+	if (UpdateShadowState(glState.mDepthTest, state.mDepthTest, stats)) {
+		if (state.mDepthTest) {
+			GL_C(glEnable(GL_DEPTH_TEST));
+		}
+		else {
+			GL_C(glDisable(GL_DEPTH_TEST));
+		}
 	}
-}
+
+	if (UpdateShadowState(glState.mDepthMask, true, stats)) {
+		GL_C(glDepthMask(GL_TRUE));
+	}
+	if (UpdateShadowState(glState.mBlend, false, stats)) {
+		GL_C(glDisable(GL_BLEND));
+	}
+	if (UpdateShadowState(glState.mColorMask, { { true, true, true, true } }, stats)) {
+		GL_C(glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE));
+	}
+	if (UpdateShadowState(glState.mCullFace, true, stats)) {
+		GL_C(glEnable(GL_CULL_FACE));
+	}
+	if (UpdateShadowState(glState.mFrontFace, (unsigned int)GL_CCW, stats)) {
+		GL_C(glFrontFace(GL_CCW));
+	}
+	if (UpdateShadowState(glState.mFramebuffer, 0u, stats)) {
+		GL_C(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+	}
+	if (UpdateShadowState(glState.mDepthFunc, (unsigned int)GL_LESS, stats)) {
+		GL_C(glDepthFunc(GL_LESS));
+	}
+	if (UpdateShadowState(glState.mProgram, state.mProgram, stats)) {
+		GL_C(glUseProgram(state.mProgram));
+		currentUploadedUniforms = &uploadedUniforms[state.mProgram];
+	}
+
+	// the units used by the textures of this draw are the ones used from now on.
+	drawTextureClock = textureClock;
+
+	return true;
+}
+
+void reglCppContext::uploadUniform(int location, const UniformValue& value) {
+	UploadedUniforms& uploaded = *currentUploadedUniforms;
+
+	// a sampler is an int uniform with the unit of its texture, so it only changes if the texture had to move to another unit.
+	if (value.mType == UniformValue::TEXTURE2D) {
+		if ((size_t)location >= uploaded.mUnits.size()) {
+			uploaded.mUnits.resize(location + 1, -1);
+		}
+		int unit = bindTexture(value.mTexture2D, uploaded.mUnits[location]);
+		if (uploaded.mUnits[location] == unit) {
+			++stats.mUniformsElided;
+			return;
+		}
+		uploaded.mUnits[location] = unit;
+		++stats.mUniformsUploaded;
+		GL_C(glUniform1i(location, unit));
+		return;
+	}
+
+	if ((size_t)location >= uploaded.mValues.size()) {
+		uploaded.mValues.resize(location + 1);
+	}
+	if (UniformValuesEqual(uploaded.mValues[location], value)) {
+		++stats.mUniformsElided;
+		return;
+	}
+	uploaded.mValues[location] = value;
+
+	++stats.mUniformsUploaded;
+	UploadUniform(location, value);
+}
+
+int reglCppContext::bindTexture(const Texture2D* texture, int preferredUnit) {
+	if (textureUnits.empty()) {
+		int maxUnits = 0;
+		GL_C(glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &maxUnits));
+		// some GPUs have hundreds of units, but a few dozen are plenty, and keep the search short.
+		textureUnits.resize(std::min(maxUnits, 32));
+	}
+
+	unsigned int textureObject = texture->mTexture.first;
+
+	int unit = -1;
+	for (size_t iUnit = 0; iUnit < textureUnits.size(); ++iUnit) {
+		if (textureUnits[iUnit].mTexture == textureObject) {
+			unit = (int)iUnit;
+			break;
+		}
+	}
+
+	if (unit != -1) {
+		++stats.mTextureBindsElided;
+	} else {
+		// keep the sampler pointing at the same unit if no other texture of this draw is using it, 
+		// and otherwise replace the texture that was used the longest time ago.
+		if (preferredUnit != -1 && textureUnits[preferredUnit].mLastUse <= drawTextureClock) {
+			unit = preferredUnit;
+		} else {
+			unit = 0;
+			for (size_t iUnit = 1; iUnit < textureUnits.size(); ++iUnit) {
+				if (textureUnits[iUnit].mLastUse < textureUnits[unit].mLastUse) {
+					unit = (int)iUnit;
+				}
+			}
+		}
+		if (textureUnits[unit].mLastUse > drawTextureClock) {
+			printf("a draw uses more than %d textures\n", (int)textureUnits.size());
+			exit(1);
+		}
+
+		if (UpdateShadowState(glState.mActiveTexture, (unsigned int)unit, stats)) {
+			GL_C(glActiveTexture(GL_TEXTURE0 + unit));
+		}
+		GL_C(glBindTexture(GL_TEXTURE_2D, textureObject));
+		textureUnits[unit].mTexture = textureObject;
+		++stats.mTextureBinds;
+	}
+
+	textureUnits[unit].mLastUse = ++textureClock;
+	return unit;
+}
+
+void reglCppContext::releaseTexture(unsigned int textureObject) {
+	// finishing a texture binds it to the active unit. if that is unknown, it could be any of them.
+	if (!glState.mActiveTexture.second) {
+		textureUnits.clear();
+		return;
+	}
+	for (TextureUnit& textureUnit : textureUnits) {
+		if (textureUnit.mTexture == textureObject) {
+			textureUnit.mTexture = 0;
+		}
+	}
+	if (glState.mActiveTexture.first < textureUnits.size()) {
+		textureUnits[glState.mActiveTexture.first].mTexture = 0;
+	}
+}
+
+void reglCppContext::uploadUniforms(const DrawCall::UniformBinding* uniforms, size_t numUniforms) {
+	for (size_t iUniform = 0; iUniform < numUniforms; ++iUniform) {
+		uploadUniform(uniforms[iUniform].mLocation, uniforms[iUniform].mValue);
+	}
+}
+
+void reglCppContext::uploadBlocks(const DrawCall::BlockBinding* blocks, size_t numBlocks, const unsigned char* blockData) {
+	if (numBlocks == 0) {
+		return;
+	}
+
+	// the ring size, which is enough for thousands of draws with a few matrices each.
+	const unsigned int ringSize = 1 << 20;
+
+	if (!uniformRing.second) {
+		GL_C(glGenBuffers(1, &uniformRing.first));
+		GL_C(glBindBuffer(GL_UNIFORM_BUFFER, uniformRing.first));
+		GL_C(glBufferData(GL_UNIFORM_BUFFER, ringSize, nullptr, GL_STREAM_DRAW));
+		GL_C(glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformRingAlignment));
+		uniformRing.second = true;
+		uniformRingOffset = 0;
+	}
+	GL_C(glBindBuffer(GL_UNIFORM_BUFFER, uniformRing.first));
+
+	auto alignedOffset = [this](unsigned int offset) {
+		return (offset + uniformRingAlignment - 1) / uniformRingAlignment * uniformRingAlignment;
+	};
+
+	// if the blocks of this draw may not fit, start over with new storage. the blocks bound so far 
+	// are in the old storage, which the buffer no longer refers to, so they have to be uploaded again.
+	unsigned int worstCase = 0;
+	for (size_t iBlock = 0; iBlock < numBlocks; ++iBlock) {
+		worstCase += alignedOffset(blocks[iBlock].mSize);
+	}
+	if (worstCase > ringSize) {
+		printf("the uniform blocks of a draw are larger than the uniform ring buffer\n");
+		exit(1);
+	}
+	if (alignedOffset(uniformRingOffset) + worstCase > ringSize) {
+		GL_C(glBufferData(GL_UNIFORM_BUFFER, ringSize, nullptr, GL_STREAM_DRAW));
+		uniformRingOffset = 0;
+		for (std::vector<unsigned char>& boundBlock : boundBlocks) {
+			boundBlock.clear();
+		}
+	}
+
+	for (size_t iBlock = 0; iBlock < numBlocks; ++iBlock) {
+		const DrawCall::BlockBinding& block = blocks[iBlock];
+		const unsigned char* data = blockData + block.mOffset;
+
+		if (block.mBinding >= boundBlocks.size()) {
+			boundBlocks.resize(block.mBinding + 1);
+		}
+		std::vector<unsigned char>& boundBlock = boundBlocks[block.mBinding];
+		if (boundBlock.size() == block.mSize && memcmp(boundBlock.data(), data, block.mSize) == 0) {
+			++stats.mBlocksReused;
+			continue;
+		}
+
+		unsigned int offset = alignedOffset(uniformRingOffset);
+#ifdef EMSCRIPTEN
+		GL_C(glBufferSubData(GL_UNIFORM_BUFFER, offset, block.mSize, data));
+#else
+		// nothing in the ring is ever overwritten before it is orphaned, so there is no need to synchronize.
+		void* dst = nullptr;
+		GL_C(dst = glMapBufferRange(GL_UNIFORM_BUFFER, offset, block.mSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+		memcpy(dst, data, block.mSize);
+		GL_C(glUnmapBuffer(GL_UNIFORM_BUFFER));
+#endif
+		GL_C(glBindBufferRange(GL_UNIFORM_BUFFER, block.mBinding, uniformRing.first, offset, block.mSize));
+
+		uniformRingOffset = offset + block.mSize;
+		boundBlock.assign(data, data + block.mSize);
+		++stats.mBlocksUploaded;
+	}
+}
+
+// the offset that an attribute is bound at in its GL buffer, see DrawState::mPooled.
+inline int BoundOffset(const VertexBuffer* vertexBuffer, bool pooled) {
+	return pooled ? vertexBuffer->mOffset : vertexBuffer->regionOffset() + vertexBuffer->mOffset;
+}
+
+// whether two attributes bind the same data in the same format, even if they are different VertexBuffers.
+inline bool SameAttribute(const DrawCall::AttributeBinding& a, const DrawCall::AttributeBinding& b, bool pooled) {
+	if (a.mLocation != b.mLocation) {
+		return false;
+	}
+	if (a.mVertexBuffer == b.mVertexBuffer) {
+		return true;
+	}
+
+	const VertexBuffer* bufferA = a.mVertexBuffer;
+	const VertexBuffer* bufferB = b.mVertexBuffer;
+	return bufferA->mBufferObject.first == bufferB->mBufferObject.first &&
+		bufferA->mNumComponents == bufferB->mNumComponents &&
+		bufferA->mGlType == bufferB->mGlType &&
+		bufferA->mNormalized == bufferB->mNormalized &&
+		bufferA->vertexStride() == bufferB->vertexStride() &&
+		bufferA->mDivisor == bufferB->mDivisor &&
+		BoundOffset(bufferA, pooled) == BoundOffset(bufferB, pooled);
+}
+
+inline bool SameIndices(const IndexBuffer* a, const IndexBuffer* b) {
+	if (a == b) {
+		return true;
+	}
+	return a != nullptr && b != nullptr && a->mBufferObject.first == b->mBufferObject.first && a->mGlType == b->mGlType;
+}
+
+unsigned int reglCppContext::fetchVertexArray(const DrawCall::AttributeBinding* attributes, size_t numAttributes, const IndexBuffer* indices, bool pooled) {
+	// the key is the index buffer, followed by the location, buffer, format, divisor and offset of each attribute.
+	// the offset includes the region, so a streaming buffer has one vertex array per region.
+	vertexArrayKey.clear();
+	vertexArrayKey.push_back(indices != nullptr ? indices->mBufferObject.first : -1);
+	for (size_t iAttribute = 0; iAttribute < numAttributes; ++iAttribute) {
+		const DrawCall::AttributeBinding& attribute = attributes[iAttribute];
+		const VertexBuffer* vertexBuffer = attribute.mVertexBuffer;
+		vertexArrayKey.push_back((unsigned int)attribute.mLocation);
+		vertexArrayKey.push_back(vertexBuffer->mBufferObject.first);
+		vertexArrayKey.push_back((unsigned int)vertexBuffer->mNumComponents);
+		vertexArrayKey.push_back(vertexBuffer->mGlType);
+		vertexArrayKey.push_back((unsigned int)vertexBuffer->mNormalized);
+		vertexArrayKey.push_back((unsigned int)vertexBuffer->vertexStride());
+		vertexArrayKey.push_back((unsigned int)vertexBuffer->mDivisor);
+		vertexArrayKey.push_back((unsigned int)BoundOffset(vertexBuffer, pooled));
+	}
+
+	auto it = vertexArrays.find(vertexArrayKey);
+	if (it != vertexArrays.end()) {
+		return it->second;
+	}
+
+	unsigned int vertexArray;
+	GL_C(glGenVertexArrays(1, &vertexArray));
+	GL_C(glBindVertexArray(vertexArray));
+	glState.mVertexArray = { vertexArray, true };
+	vertexArrays[vertexArrayKey] = vertexArray;
+	++stats.mVertexArraysCreated;
+
+	for (size_t iAttribute = 0; iAttribute < numAttributes; ++iAttribute) {
+		const DrawCall::AttributeBinding& attribute = attributes[iAttribute];
+		VertexBuffer* attributeVertexBuffer = attribute.mVertexBuffer;
+
+		GL_C(glBindBuffer(GL_ARRAY_BUFFER, attributeVertexBuffer->mBufferObject.first));
+		
+		GL_C(glVertexAttribPointer(
+			(GLuint)attribute.mLocation, 
+			attributeVertexBuffer->mNumComponents,
+			attributeVertexBuffer->mGlType,
+			attributeVertexBuffer->mNormalized ? GL_TRUE : GL_FALSE, 
+			attributeVertexBuffer->vertexStride(),
+			(void*)(size_t)BoundOffset(attributeVertexBuffer, pooled)));
+		
+		GL_C(glEnableVertexAttribArray((GLuint)attribute.mLocation));
+		GL_C(glVertexAttribDivisor((GLuint)attribute.mLocation, attributeVertexBuffer->mDivisor));
+	}
+
+	if (indices != nullptr) {
+		GL_C(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices->mBufferObject.first));
+	}
+	return vertexArray;
+}
+
+void reglCppContext::bindVertexArray(unsigned int vertexArray) {
+	if (UpdateShadowState(glState.mVertexArray, vertexArray, stats)) {
+		GL_C(glBindVertexArray(vertexArray));
+	}
+}
+
+void reglCppContext::bindVertexArray(const DrawState& state, const DrawCall::AttributeBinding* attributes, size_t numAttributes) {
+	if (state.mVertexArray != 0 && state.mVertexArrayGeneration != vertexArrayGeneration) {
+		state.mVertexArray = fetchVertexArray(attributes, numAttributes, state.mIndices, state.mPooled);
+		state.mVertexArrayGeneration = vertexArrayGeneration;
+	}
+
+	if (state.mVertexArray != 0) {
+		bindVertexArray(state.mVertexArray);
+	} else {
+		bindVertexArray(attributes, numAttributes, state.mIndices, state.mPooled);
+	}
+}
+
+void reglCppContext::releaseVertexArrays(unsigned int bufferObject) {
+	for (auto it = vertexArrays.begin(); it != vertexArrays.end();) {
+		const std::vector<unsigned int>& key = it->first;
+
+		bool usesBuffer = key[0] == bufferObject;
+		for (size_t iBuffer = 2; iBuffer < key.size(); iBuffer += 8) {
+			usesBuffer = usesBuffer || key[iBuffer] == bufferObject;
+		}
+
+		if (!usesBuffer) {
+			++it;
+			continue;
+		}
+
+		if (glState.mVertexArray.first == it->second) {
+			glState.mVertexArray.second = false;
+		}
+		GL_C(glDeleteVertexArrays(1, &it->second));
+		it = vertexArrays.erase(it);
+		++vertexArrayGeneration;
+	}
+}
+
+void reglCppContext::drawPrimitives(const DrawState& state, const DrawCall::AttributeBinding* attributes, size_t numAttributes) {
+	bindVertexArray(state, attributes, numAttributes);
+	drawBoundPrimitives(state);
+}
+
+void reglCppContext::drawBoundPrimitives(const DrawState& state) {
+	if (state.mIndices != nullptr) {
+		const void* offset = (const void*)(size_t)(state.mIndices->mIndexSize * state.mFirst);
+		GLenum type = state.mIndices->mGlType;
+
+#ifdef EMSCRIPTEN
+		if (state.mInstances != -1) {
+			GL_C(glDrawElementsInstanced(state.mPrimitive, state.mCount, type, offset, state.mInstances));
+		} else {
+			GL_C(glDrawElements(state.mPrimitive, state.mCount, type, offset));
+		}
+#else
+		if (state.mInstances != -1) {
+			GL_C(glDrawElementsInstancedBaseVertex(state.mPrimitive, state.mCount, type, offset, state.mInstances, state.mBaseVertex));
+		} else if (state.mBaseVertex != 0) {
+			GL_C(glDrawElementsBaseVertex(state.mPrimitive, state.mCount, type, offset, state.mBaseVertex));
+		} else {
+			GL_C(glDrawElements(state.mPrimitive, state.mCount, type, offset));
+		}
+#endif
+	}
+	else {
+		if (state.mInstances != -1) {
+			GL_C(glDrawArraysInstanced(state.mPrimitive, state.mFirst, state.mCount, state.mInstances));
+		} else {
+			GL_C(glDrawArrays(state.mPrimitive, state.mFirst, state.mCount));
+		}
+	}
+}
+
+void DrawCall::draw() {
+	mContext->executeDrawCall(*this, nullptr);
+}
+
+void DrawCall::draw(const std::vector<Uniform>& dynamicUniforms) {
+	mContext->executeDrawCall(*this, &dynamicUniforms);
+}
+
+void reglCppContext::executeDrawCall(const DrawCall& drawCall, const std::vector<Uniform>* dynamicUniforms) {
+	if (recordingBuffer != nullptr) {
+		recordingBuffer->record(drawCall, dynamicUniforms);
+		return;
+	}
+
+	if (!applyDrawState(drawCall)) {
+		return;
+	}
+
+	uploadUniforms(drawCall.mUniforms.data(), drawCall.mUniforms.size());
+
+	if (dynamicUniforms != nullptr && drawCall.mBlockMembers != nullptr && !drawCall.mBlockMembers->empty()) {
+		blockScratch = drawCall.mBlockData;
+		WriteDynamicBlockMembers(blockScratch.data(), drawCall.mBlocks.data(), *drawCall.mBlockMembers, *dynamicUniforms);
+		uploadBlocks(drawCall.mBlocks.data(), drawCall.mBlocks.size(), blockScratch.data());
+	} else {
+		uploadBlocks(drawCall.mBlocks.data(), drawCall.mBlocks.size(), drawCall.mBlockData.data());
+	}
+
+	if (dynamicUniforms != nullptr) {
+		for (const Uniform& uniform : *dynamicUniforms) {
+			int location = drawCall.uniformLocation(uniform.mKey.mId);
+			if (location == -1) {
+				continue;
+			}
+			uploadUniform(location, uniform.mValue);
+		}
+	}
+
+	drawPrimitives(drawCall, drawCall.mAttributes.data(), drawCall.mAttributes.size());
+}
+
+void CommandBuffer::record(const DrawCall& drawCall, const std::vector<Uniform>* dynamicUniforms) {
+	RecordedDraw recordedDraw;
+	recordedDraw.mSequence = (unsigned int)mDraws.size();
+	recordedDraw.mState = drawCall;
+
+	recordedDraw.mFirstUniform = (unsigned int)mUniforms.size();
+	mUniforms.insert(mUniforms.end(), drawCall.mUniforms.begin(), drawCall.mUniforms.end());
+	if (dynamicUniforms != nullptr) {
+		for (const Uniform& uniform : *dynamicUniforms) {
+			int location = drawCall.uniformLocation(uniform.mKey.mId);
+			if (location == -1) {
+				continue;
+			}
+			mUniforms.push_back({ location, uniform.mValue });
+		}
+	}
+	recordedDraw.mNumUniforms = (unsigned int)mUniforms.size() - recordedDraw.mFirstUniform;
+
+	recordedDraw.mFirstAttribute = (unsigned int)mAttributes.size();
+	mAttributes.insert(mAttributes.end(), drawCall.mAttributes.begin(), drawCall.mAttributes.end());
+	recordedDraw.mNumAttributes = (unsigned int)drawCall.mAttributes.size();
+
+	unsigned int blockDataOffset = (unsigned int)mBlockData.size();
+	recordedDraw.mFirstBlock = (unsigned int)mBlocks.size();
+	for (const DrawCall::BlockBinding& block : drawCall.mBlocks) {
+		mBlocks.push_back({ block.mBinding, blockDataOffset + block.mOffset, block.mSize });
+	}
+	recordedDraw.mNumBlocks = (unsigned int)drawCall.mBlocks.size();
+	mBlockData.insert(mBlockData.end(), drawCall.mBlockData.begin(), drawCall.mBlockData.end());
+	if (dynamicUniforms != nullptr && drawCall.mBlockMembers != nullptr) {
+		WriteDynamicBlockMembers(mBlockData.data() + blockDataOffset, drawCall.mBlocks.data(), *drawCall.mBlockMembers, *dynamicUniforms);
+	}
+
+	// the key, from the most to the least significant bits:
+	// framebuffer(8) | program(16) | texture(16) | vertex or index buffer(16) | depth test(8)
+	// where the texture and the buffer are the first ones that the draw binds.
+	unsigned long long texture = 0;
+	for (const DrawCall::UniformBinding& uniform : drawCall.mUniforms) {
+		if (uniform.mValue.mType == UniformValue::TEXTURE2D) {
+			texture = uniform.mValue.mTexture2D->mTexture.first;
+			break;
+		}
+	}
+	unsigned long long buffer = 0;
+	if (drawCall.mIndices != nullptr) {
+		buffer = drawCall.mIndices->mBufferObject.first;
+	} else if (!drawCall.mAttributes.empty()) {
+		buffer = drawCall.mAttributes[0].mVertexBuffer->mBufferObject.first;
+	}
+	unsigned long long framebuffer = 0; // only the default framebuffer is supported for now.
+
+	recordedDraw.mSortKey =
+		((framebuffer & 0xFF) << 56) |
+		(((unsigned long long)drawCall.mProgram & 0xFFFF) << 40) |
+		((texture & 0xFFFF) << 24) |
+		((buffer & 0xFFFF) << 8) |
+		(drawCall.mDepthTest ? 1 : 0);
+
+	mDraws.push_back(recordedDraw);
+}
+
+void CommandBuffer::flush() {
+	// clears and ordered draws split the draws into passes, and the draws are only sorted within their pass.
+	// the sequence number makes the sort stable, without the allocation that std::stable_sort does.
+	auto compare = [](const RecordedDraw& a, const RecordedDraw& b) {
+		return a.mSortKey != b.mSortKey ? a.mSortKey < b.mSortKey : a.mSequence < b.mSequence;
+	};
+	size_t passBegin = 0;
+	for (size_t iDraw = 0; iDraw <= mDraws.size(); ++iDraw) {
+		if (iDraw == mDraws.size() || mDraws[iDraw].mState.mClear || mDraws[iDraw].mState.mOrdered) {
+			std::sort(mDraws.begin() + passBegin, mDraws.begin() + iDraw, compare);
+			passBegin = iDraw + 1;
+		}
+	}
+
+	// stop recording before executing, so that the draws are not recorded again.
+	mContext->recordingBuffer = nullptr;
+
+	for (size_t iDraw = 0; iDraw < mDraws.size();) {
+		if (!mContext->batchedUniforms.empty()) {
+			size_t numBatched = mContext->executeBatch(*this, iDraw);
+			if (numBatched > 0) {
+				iDraw += numBatched;
+				continue;
+			}
+		}
+
+		size_t numMerged = mContext->executeMultiDraw(*this, iDraw);
+		if (numMerged > 0) {
+			iDraw += numMerged;
+			continue;
+		}
+
+		const RecordedDraw& recordedDraw = mDraws[iDraw];
+		++iDraw;
+
+		if (!mContext->applyDrawState(recordedDraw.mState)) {
+			continue;
+		}
+
+		mContext->uploadUniforms(mUniforms.data() + recordedDraw.mFirstUniform, recordedDraw.mNumUniforms);
+		mContext->uploadBlocks(mBlocks.data() + recordedDraw.mFirstBlock, recordedDraw.mNumBlocks, mBlockData.data());
+		mContext->drawPrimitives(recordedDraw.mState, mAttributes.data() + recordedDraw.mFirstAttribute, recordedDraw.mNumAttributes);
+	}
+
+	clear();
+}
+
+void CommandBuffer::append(const CommandBuffer& other) {
+	unsigned int uniformOffset = (unsigned int)mUniforms.size();
+	unsigned int attributeOffset = (unsigned int)mAttributes.size();
+	unsigned int sequenceOffset = (unsigned int)mDraws.size();
+	unsigned int blockOffset = (unsigned int)mBlocks.size();
+	unsigned int blockDataOffset = (unsigned int)mBlockData.size();
+
+	for (RecordedDraw recordedDraw : other.mDraws) {
+		recordedDraw.mFirstUniform += uniformOffset;
+		recordedDraw.mFirstAttribute += attributeOffset;
+		recordedDraw.mFirstBlock += blockOffset;
+		recordedDraw.mSequence += sequenceOffset;
+		mDraws.push_back(recordedDraw);
+	}
+	mUniforms.insert(mUniforms.end(), other.mUniforms.begin(), other.mUniforms.end());
+	mAttributes.insert(mAttributes.end(), other.mAttributes.begin(), other.mAttributes.end());
+
+	for (DrawCall::BlockBinding block : other.mBlocks) {
+		block.mOffset += blockDataOffset;
+		mBlocks.push_back(block);
+	}
+	mBlockData.insert(mBlockData.end(), other.mBlockData.begin(), other.mBlockData.end());
+}
+
+void CommandBuffer::clear() {
+	mDraws.clear();
+	mUniforms.clear();
+	mAttributes.clear();
+	mBlocks.clear();
+	mBlockData.clear();
+}
+
+bool CommandBuffer::sameBlocks(const RecordedDraw& a, const RecordedDraw& b) const {
+	if (a.mNumBlocks != b.mNumBlocks) {
+		return false;
+	}
+	for (unsigned int iBlock = 0; iBlock < a.mNumBlocks; ++iBlock) {
+		const DrawCall::BlockBinding& blockA = mBlocks[a.mFirstBlock + iBlock];
+		const DrawCall::BlockBinding& blockB = mBlocks[b.mFirstBlock + iBlock];
+		if (blockA.mBinding != blockB.mBinding || blockA.mSize != blockB.mSize ||
+			memcmp(mBlockData.data() + blockA.mOffset, mBlockData.data() + blockB.mOffset, blockA.mSize) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+DrawCall reglCppContext::compile(const Command& command) {
+	// outside of a frame, the stack is empty and the command is resolved against the default state.
+	contextState state;
+	resolveState(command, nullptr, state);
+
+	DrawCall drawCall;
+	compileState(state, drawCall, false);
+	return drawCall;
+}
 
 void reglCppContext::submit(const Command& command) {
+	submit(command, (const void*)nullptr);
+}
 
-	// current state at top of stack.
-	contextState stackState = stateStack.top();
+void reglCppContext::submit(const Command& command, const void* props) {
+	resolveState(command, props, scratchState);
 
-	transferStack(stackState, command);
+	compileState(scratchState, scratchDrawCall, true);
+	scratchDrawCall.draw();
+}
 
-	submitWithContextState(stackState);
-	
+void reglCppContext::pushScope(const Command& command, const void* props) {
+	size_t depth = stateStack.size();
+	while (resolvedStates.size() < depth + 2) {
+		resolvedStates.emplace_back();
+	}
+
+	// the props of the scope are read once here, instead of on every submit inside of it.
+	resolvedStates[depth + 1].assign(resolvedStates[depth], numSymbols());
+	transferStack(resolvedStates[depth + 1], command, props);
+	stateStack.push_back({ &command, props });
+}
+
+void reglCppContext::popScope() {
+	stateStack.pop_back();
+}
+
+// the number of floats of a uniform value that can be turned into a per instance attribute, and 0 for the others.
+inline int InstanceAttributeSize(UniformValue::UniformType type) {
+	switch (type) {
+	case UniformValue::FLOAT_VEC1: return 1;
+	case UniformValue::FLOAT_VEC2: return 2;
+	case UniformValue::FLOAT_VEC3: return 3;
+	case UniformValue::FLOAT_VEC4: return 4;
+	case UniformValue::FLOAT_MAT4X4: return 16;
+	default: return 0;
+	}
 }
 
-void reglCppContext::submit(const Command& command, const std::function<void()>& fn) {
-	contextState stackState = stateStack.top();
-	transferStack(stackState, command);
-	stateStack.push(stackState);
-	fn();
-	stateStack.pop();
+// turns the declarations 'uniform <type> <name>;' in 'vert' into 'attribute <type> <name>;', or 'in <type> <name>;' in GLSL 330.
+// returns false if one of the uniforms is not declared that way, or is also used by the fragment shader.
+inline bool RewriteUniformsAsAttributes(std::string& vert, const std::string& frag, const std::vector<unsigned int>& symbols) {
+	const std::string qualifier = HasVersionDirective(vert) ? "in" : "attribute";
+
+	for (unsigned int symbol : symbols) {
+		const std::string& name = symbolName(symbol);
+		
+		if (std::regex_search(frag, std::regex("\\b" + name + "\\b"))) {
+			return false;
+		}
+
+		std::regex declaration("\\buniform(\\s+(?:lowp|mediump|highp))?\\s+(float|vec2|vec3|vec4|mat4)\\s+" + name + "\\s*;");
+		if (!std::regex_search(vert, declaration)) {
+			return false;
+		}
+		vert = std::regex_replace(vert, declaration, qualifier + "$1 $2 " + name + ";");
+	}
+	return true;
+}
+
+const reglCppContext::InstancedProgram& reglCppContext::fetchInstancedProgram(const ProgramInfo& programInfo, const std::vector<unsigned int>& symbols) {
+	instancedProgramKey.first = programInfo.mProgram;
+	instancedProgramKey.second.assign(symbols.begin(), symbols.end());
+	auto it = instancedPrograms.find(instancedProgramKey);
+	if (it != instancedPrograms.end()) {
+		return it->second;
+	}
+
+	InstancedProgram& instancedProgram = instancedPrograms[instancedProgramKey];
+
+	std::string vert = programInfo.mVert;
+	if (!RewriteUniformsAsAttributes(vert, programInfo.mFrag, symbols)) {
+		instancedProgram.mValid = false;
+		return instancedProgram;
+	}
+
+	instancedProgram.mInfo.mVertHash = shaderHash(vert);
+	instancedProgram.mInfo.mFragHash = programInfo.mFragHash;
+	instancedProgram.mInfo.mKey = ProgramKey(instancedProgram.mInfo.mVertHash, instancedProgram.mInfo.mFragHash, programInfo.mDefines);
+	instancedProgram.mInfo.mVert = vert;
+	instancedProgram.mInfo.mFrag = programInfo.mFrag;
+	instancedProgram.mInfo.mDefines = programInfo.mDefines;
+	beginProgram(instancedProgram.mInfo);
+	endProgram(instancedProgram.mInfo);
+	instancedProgram.mValid = true;
+
+	return instancedProgram;
+}
+
+size_t reglCppContext::executeBatch(const CommandBuffer& buffer, size_t begin) {
+	typedef CommandBuffer::RecordedDraw RecordedDraw;
+
+	auto canBatch = [](const RecordedDraw& draw) {
+		return draw.mState.mDraw && !draw.mState.mClear && !draw.mState.mOrdered && draw.mState.mInstances == -1;
+	};
+
+	const RecordedDraw& first = buffer.mDraws[begin];
+	if (!canBatch(first)) {
+		return 0;
+	}
+
+	auto programIt = programsById.find(first.mState.mProgram);
+	if (programIt == programsById.end()) {
+		return 0;
+	}
+	const ProgramInfo& programInfo = *programIt->second;
+
+	// the batched uniforms that the program uses, and their locations.
+	batchSymbols.clear();
+	batchLocations.clear();
+	for (unsigned int symbol : batchedUniforms) {
+		if (symbol < programInfo.mUniformLocations.size() && programInfo.mUniformLocations[symbol] != -1) {
+			batchSymbols.push_back(symbol);
+			batchLocations.push_back(programInfo.mUniformLocations[symbol]);
+		}
+	}
+	if (batchSymbols.empty()) {
+		return 0;
+	}
+
+	auto isBatchedLocation = [this](int location) {
+		return std::find(batchLocations.begin(), batchLocations.end(), location) != batchLocations.end();
+	};
+
+	auto canMerge = [&](const RecordedDraw& draw) {
+		if (!canBatch(draw) ||
+			draw.mState.mViewport != first.mState.mViewport ||
+			draw.mState.mDepthTest != first.mState.mDepthTest ||
+			draw.mState.mProgram != first.mState.mProgram ||
+			draw.mState.mPrimitive != first.mState.mPrimitive ||
+			draw.mState.mIndices != first.mState.mIndices ||
+			draw.mState.mCount != first.mState.mCount ||
+			draw.mState.mFirst != first.mState.mFirst ||
+			draw.mState.mBaseVertex != first.mState.mBaseVertex ||
+			draw.mNumUniforms != first.mNumUniforms ||
+			draw.mNumAttributes != first.mNumAttributes ||
+			!buffer.sameBlocks(draw, first)) {
+			return false;
+		}
+
+		for (unsigned int iAttribute = 0; iAttribute < first.mNumAttributes; ++iAttribute) {
+			const DrawCall::AttributeBinding& a = buffer.mAttributes[first.mFirstAttribute + iAttribute];
+			const DrawCall::AttributeBinding& b = buffer.mAttributes[draw.mFirstAttribute + iAttribute];
+			if (a.mLocation != b.mLocation || a.mVertexBuffer != b.mVertexBuffer) {
+				return false;
+			}
+		}
+
+		for (unsigned int iUniform = 0; iUniform < first.mNumUniforms; ++iUniform) {
+			const DrawCall::UniformBinding& a = buffer.mUniforms[first.mFirstUniform + iUniform];
+			const DrawCall::UniformBinding& b = buffer.mUniforms[draw.mFirstUniform + iUniform];
+			if (a.mLocation != b.mLocation) {
+				return false;
+			}
+			if (isBatchedLocation(a.mLocation)) {
+				if (a.mValue.mType != b.mValue.mType || InstanceAttributeSize(a.mValue.mType) == 0) {
+					return false;
+				}
+			} else if (!UniformValuesEqual(a.mValue, b.mValue)) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	if (!canMerge(first)) {
+		return 0;
+	}
+
+	size_t end = begin + 1;
+	while (end < buffer.mDraws.size() && canMerge(buffer.mDraws[end])) {
+		++end;
+	}
+	size_t numInstances = end - begin;
+	if (numInstances < 2) {
+		return 0;
+	}
+
+	const InstancedProgram& instancedProgram = fetchInstancedProgram(programInfo, batchSymbols);
+	if (!instancedProgram.mValid) {
+		return 0;
+	}
+
+	// the value of a batched uniform in a draw. a draw may set a uniform several times, e.g. as a dynamic uniform, 
+	// and then the last value is the one that counts. nullptr if the uniform is not set, which is the same in all the merged draws.
+	auto batchedValue = [&buffer](const RecordedDraw& draw, int location) {
+		const UniformValue* value = nullptr;
+		for (unsigned int iUniform = 0; iUniform < draw.mNumUniforms; ++iUniform) {
+			if (buffer.mUniforms[draw.mFirstUniform + iUniform].mLocation == location) {
+				value = &buffer.mUniforms[draw.mFirstUniform + iUniform].mValue;
+			}
+		}
+		return value;
+	};
+
+	// lay out the per instance data as one block per batched uniform.
+	batchData.clear();
+	batchSizes.clear();
+	batchOffsets.clear();
+	for (size_t iSymbol = 0; iSymbol < batchSymbols.size(); ++iSymbol) {
+		const UniformValue* firstValue = batchedValue(first, batchLocations[iSymbol]);
+		batchSizes.push_back(firstValue != nullptr ? InstanceAttributeSize(firstValue->mType) : 0);
+		batchOffsets.push_back((int)batchData.size());
+
+		if (firstValue == nullptr) {
+			continue;
+		}
+
+		for (size_t iDraw = begin; iDraw < end; ++iDraw) {
+			const UniformValue* value = batchedValue(buffer.mDraws[iDraw], batchLocations[iSymbol]);
+			const float* floats = (const float*)&value->mFloatMat4x4[0][0];
+			batchData.insert(batchData.end(), floats, floats + batchSizes[iSymbol]);
+		}
+	}
+
+	if (!batchBuffer.second) {
+		GL_C(glGenBuffers(1, &batchBuffer.first));
+		batchBuffer.second = true;
+	}
+
+	// orphan the previous contents, so that the upload doesn't wait for earlier batches.
+	GL_C(glBindBuffer(GL_ARRAY_BUFFER, batchBuffer.first));
+	GL_C(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * batchData.size(), batchData.data(), GL_STREAM_DRAW));
+
+	// the locations in the instanced program differ from those of the original.
+	auto symbolOfLocation = [](const std::vector<ProgramInfo::ActiveVariable>& variables, int location) {
+		for (const ProgramInfo::ActiveVariable& variable : variables) {
+			if (variable.mLocation == location) {
+				return (int)variable.mSymbol;
+			}
+		}
+		return -1;
+	};
+	auto locationOfSymbol = [](const std::vector<ProgramInfo::ActiveVariable>& variables, int symbol) {
+		for (const ProgramInfo::ActiveVariable& variable : variables) {
+			if ((int)variable.mSymbol == symbol) {
+				return variable.mLocation;
+			}
+		}
+		return -1;
+	};
+
+	batchUniformBindings.clear();
+	for (unsigned int iUniform = 0; iUniform < first.mNumUniforms; ++iUniform) {
+		const DrawCall::UniformBinding& uniform = buffer.mUniforms[first.mFirstUniform + iUniform];
+		int symbol = symbolOfLocation(programInfo.mUniforms, uniform.mLocation);
+		int location = locationOfSymbol(instancedProgram.mInfo.mUniforms, symbol);
+		if (location != -1) {
+			batchUniformBindings.push_back({ location, uniform.mValue });
+		}
+	}
+
+	batchAttributeBindings.clear();
+	for (unsigned int iAttribute = 0; iAttribute < first.mNumAttributes; ++iAttribute) {
+		const DrawCall::AttributeBinding& attribute = buffer.mAttributes[first.mFirstAttribute + iAttribute];
+		int symbol = symbolOfLocation(programInfo.mAttributes, attribute.mLocation);
+		int location = locationOfSymbol(instancedProgram.mInfo.mAttributes, symbol);
+		if (location != -1) {
+			batchAttributeBindings.push_back({ location, attribute.mVertexBuffer });
+		}
+	}
+
+	DrawState state = first.mState;
+	state.mProgram = instancedProgram.mInfo.mProgram;
+	state.mInstances = (int)numInstances;
+
+	applyDrawState(state);
+
+	uploadUniforms(batchUniformBindings.data(), batchUniformBindings.size());
+	uploadBlocks(buffer.mBlocks.data() + first.mFirstBlock, first.mNumBlocks, buffer.mBlockData.data());
+
+	// the instance attributes are added to the cached vertex array of the other attributes, and removed after the draw.
+	bindVertexArray(batchAttributeBindings.data(), batchAttributeBindings.size(), state.mIndices, state.mPooled);
+	GL_C(glBindBuffer(GL_ARRAY_BUFFER, batchBuffer.first));
+
+	// a mat4 attribute takes up four consecutive locations, one per column.
+	auto numColumns = [](int size) {
+		return size == 16 ? 4 : 1;
+	};
+
+	for (size_t iSymbol = 0; iSymbol < batchSymbols.size(); ++iSymbol) {
+		int location = locationOfSymbol(instancedProgram.mInfo.mAttributes, batchSymbols[iSymbol]);
+		int size = batchSizes[iSymbol];
+		if (location == -1 || size == 0) {
+			continue;
+		}
+
+		int columnSize = size / numColumns(size);
+		for (int iColumn = 0; iColumn < numColumns(size); ++iColumn) {
+			size_t offset = sizeof(float) * (batchOffsets[iSymbol] + iColumn * columnSize);
+			GL_C(glVertexAttribPointer(
+				(GLuint)(location + iColumn),
+				columnSize,
+				GL_FLOAT,
+				GL_FALSE,
+				sizeof(float) * size,
+				(void*)offset));
+			GL_C(glEnableVertexAttribArray((GLuint)(location + iColumn)));
+			GL_C(glVertexAttribDivisor((GLuint)(location + iColumn), 1));
+		}
+	}
+
+	drawBoundPrimitives(state);
+
+	// leave the vertex array as it was, so the instance attributes don't affect the draws after this one.
+	for (size_t iSymbol = 0; iSymbol < batchSymbols.size(); ++iSymbol) {
+		int location = locationOfSymbol(instancedProgram.mInfo.mAttributes, batchSymbols[iSymbol]);
+		int size = batchSizes[iSymbol];
+		if (location == -1 || size == 0) {
+			continue;
+		}
+
+		for (int iColumn = 0; iColumn < numColumns(size); ++iColumn) {
+			GL_C(glVertexAttribDivisor((GLuint)(location + iColumn), 0));
+			GL_C(glDisableVertexAttribArray((GLuint)(location + iColumn)));
+		}
+	}
+
+	stats.mDrawsBatched += (int)numInstances;
+
+	return numInstances;
+}
+
+size_t reglCppContext::executeMultiDraw(const CommandBuffer& buffer, size_t begin) {
+#ifdef EMSCRIPTEN
+	// there are no multi-draw calls in WebGL.
+	return 0;
+#else
+	typedef CommandBuffer::RecordedDraw RecordedDraw;
+
+	const RecordedDraw& first = buffer.mDraws[begin];
+	if (!first.mState.mDraw || first.mState.mClear || first.mState.mOrdered || first.mState.mInstances != -1) {
+		return 0;
+	}
+
+	auto canMerge = [&](const RecordedDraw& draw) {
+		if (!draw.mState.mDraw || draw.mState.mClear || draw.mState.mOrdered || draw.mState.mInstances != -1 ||
+			draw.mState.mViewport != first.mState.mViewport ||
+			draw.mState.mDepthTest != first.mState.mDepthTest ||
+			draw.mState.mProgram != first.mState.mProgram ||
+			draw.mState.mPrimitive != first.mState.mPrimitive ||
+			!SameIndices(draw.mState.mIndices, first.mState.mIndices) ||
+			draw.mState.mPooled != first.mState.mPooled ||
+			draw.mNumUniforms != first.mNumUniforms ||
+			draw.mNumAttributes != first.mNumAttributes ||
+			!buffer.sameBlocks(draw, first)) {
+			return false;
+		}
+
+		// draws of different meshes in the same pool arenas bind the same vertex array.
+		for (unsigned int iAttribute = 0; iAttribute < first.mNumAttributes; ++iAttribute) {
+			const DrawCall::AttributeBinding& a = buffer.mAttributes[first.mFirstAttribute + iAttribute];
+			const DrawCall::AttributeBinding& b = buffer.mAttributes[draw.mFirstAttribute + iAttribute];
+			if (!SameAttribute(a, b, first.mState.mPooled)) {
+				return false;
+			}
+		}
+
+		for (unsigned int iUniform = 0; iUniform < first.mNumUniforms; ++iUniform) {
+			const DrawCall::UniformBinding& a = buffer.mUniforms[first.mFirstUniform + iUniform];
+			const DrawCall::UniformBinding& b = buffer.mUniforms[draw.mFirstUniform + iUniform];
+			if (a.mLocation != b.mLocation || !UniformValuesEqual(a.mValue, b.mValue)) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	size_t end = begin + 1;
+	while (end < buffer.mDraws.size() && canMerge(buffer.mDraws[end])) {
+		++end;
+	}
+	if (end - begin < 2) {
+		return 0;
+	}
+
+	multiDrawFirsts.clear();
+	multiDrawCounts.clear();
+	multiDrawBaseVertices.clear();
+	multiDrawOffsets.clear();
+	for (size_t iDraw = begin; iDraw < end; ++iDraw) {
+		const DrawState& state = buffer.mDraws[iDraw].mState;
+		multiDrawFirsts.push_back(state.mFirst);
+		multiDrawCounts.push_back(state.mCount);
+		multiDrawBaseVertices.push_back(state.mBaseVertex);
+		multiDrawOffsets.push_back(state.mIndices != nullptr ? (const void*)(size_t)(state.mIndices->mIndexSize * state.mFirst) : nullptr);
+	}
+
+	applyDrawState(first.mState);
+
+	uploadUniforms(buffer.mUniforms.data() + first.mFirstUniform, first.mNumUniforms);
+	uploadBlocks(buffer.mBlocks.data() + first.mFirstBlock, first.mNumBlocks, buffer.mBlockData.data());
+	bindVertexArray(first.mState, buffer.mAttributes.data() + first.mFirstAttribute, first.mNumAttributes);
+
+	if (first.mState.mIndices != nullptr) {
+		GL_C(glMultiDrawElementsBaseVertex(
+			first.mState.mPrimitive,
+			multiDrawCounts.data(),
+			first.mState.mIndices->mGlType,
+			multiDrawOffsets.data(),
+			(GLsizei)multiDrawCounts.size(),
+			multiDrawBaseVertices.data()));
+	} else {
+		GL_C(glMultiDrawArrays(
+			first.mState.mPrimitive,
+			multiDrawFirsts.data(),
+			multiDrawCounts.data(),
+			(GLsizei)multiDrawCounts.size()));
+	}
+
+	stats.mDrawsMultiDrawn += (int)(end - begin);
+
+	return end - begin;
+#endif
+}
+
+void reglCppContext::enableBatching(const std::vector<Symbol>& instancedUniforms) {
+	batchedUniforms.clear();
+	for (const Symbol& symbol : instancedUniforms) {
+		batchedUniforms.push_back(symbol.mId);
+	}
+	std::sort(batchedUniforms.begin(), batchedUniforms.end());
+}
+
+void reglCppContext::disableBatching() {
+	batchedUniforms.clear();
+}
+
+void reglCppContext::createRecorders(int numThreads) {
+	recorders.resize(numThreads);
+	for (CommandBuffer& threadRecorder : recorders) {
+		threadRecorder.mContext = this;
+	}
+}
+
+CommandBuffer& reglCppContext::record() {
+	commandBuffer.mContext = this;
+	recordingBuffer = &commandBuffer;
+	return commandBuffer;
+}
+
+void reglCppContext::invalidateState() {
+	glState = GlState();
+	boundBlocks.clear();
+	uploadedUniforms.clear();
+	currentUploadedUniforms = nullptr;
+	textureUnits.clear();
 }
 
 void reglCppContext::dispose() {
 	
-	for (auto& pair : programCache) {
-		ProgramInfo programCache = pair.second;
-		GL_C(glDeleteProgram(programCache.mProgram));
+	for (const ProgramInfo& programInfo : programCache) {
+		if (programInfo.mVertexShader != 0) {
+			GL_C(glDeleteShader(programInfo.mVertexShader));
+			GL_C(glDeleteShader(programInfo.mFragmentShader));
+		}
+		GL_C(glDeleteProgram(programInfo.mProgram));
 	}
 	programCache.clear();
+	fallback = nullptr;
+	programsById.clear();
+	programTable.clear();
+
+	for (auto& pair : instancedPrograms) {
+		if (pair.second.mValid) {
+			GL_C(glDeleteProgram(pair.second.mInfo.mProgram));
+		}
+	}
+	instancedPrograms.clear();
+
+	if (batchBuffer.second) {
+		GL_C(glDeleteBuffers(1, &batchBuffer.first));
+		batchBuffer.second = false;
+	}
+
+	for (auto& pair : vertexArrays) {
+		GL_C(glDeleteVertexArrays(1, &pair.second));
+	}
+	vertexArrays.clear();
+	++vertexArrayGeneration;
+
+#ifndef EMSCRIPTEN
+	for (FrameFence& fence : frameFences) {
+		if (fence.mSync != nullptr) {
+			GL_C(glDeleteSync((GLsync)fence.mSync));
+		}
+		fence = FrameFence();
+	}
+#endif
+
+	if (uniformRing.second) {
+		GL_C(glDeleteBuffers(1, &uniformRing.first));
+		uniformRing.second = false;
+	}
+	blockBindings.clear();
+
+	invalidateState();
 
 }
 
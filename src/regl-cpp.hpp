@@ -4,8 +4,14 @@
 #include <array>
 #include <vector>
 #include <functional>
-#include <stack>
 #include <map>
+#include <deque>
+#include <set>
+#include <utility>
+#include <type_traits>
+#include <new>
+#include <memory>
+#include <initializer_list>
 
 #include <math.h>
 
@@ -13,6 +19,45 @@ namespace reglCpp
 {
 
 struct Texture2D;
+
+// interns 'name' into the global symbol table, and returns its id. 
+// ids are small integers handed out in the order that names are first seen, so they can index dense arrays.
+unsigned int internSymbol(const std::string& name);
+const std::string& symbolName(unsigned int id);
+unsigned int numSymbols();
+
+// a 64 bit hash of the contents of a shader. Command::vert() and Command::frag() compute it once,
+// so that looking up the program of a Command doesn't depend on the length of its sources.
+unsigned long long shaderHash(const std::string& source);
+
+// the bit of the preprocessor define 'name' in a set of defines, see Command::defines(). 
+// like symbols, the bits are handed out in the order that names are first seen, and at most 64 names can be used.
+// so the bits are only valid within a process, and the defines are inserted into the sources sorted by name.
+unsigned long long defineBit(const std::string& name);
+
+/*
+The name of a uniform or an attribute, as an interned symbol id.
+Constructing it from a string does a lookup in the symbol table, so for names used every frame
+it is better to create the Symbol once, e.g. 'static const Symbol uModelMatrix("uModelMatrix");'
+*/
+struct Symbol {
+	unsigned int mId;
+
+	Symbol(const char* name) : mId(internSymbol(name)) {}
+	Symbol(const std::string& name) : mId(internSymbol(name)) {}
+
+	const std::string& name() const {
+		return symbolName(mId);
+	}
+
+	bool operator==(const Symbol& other) const {
+		return mId == other.mId;
+	}
+
+	bool operator!=(const Symbol& other) const {
+		return mId != other.mId;
+	}
+};
 	
 struct UniformValue {
 	
@@ -26,6 +71,9 @@ struct UniformValue {
 
 		TEXTURE2D,
 
+		// a value that is read from the props passed to submit(), see prop().
+		PROP,
+
 		UNSET
 	};
 	
@@ -38,6 +86,11 @@ struct UniformValue {
 		std::array<std::array<float, 4>, 4 > mFloatMat4x4;
 
 		Texture2D* mTexture2D;
+
+		struct {
+			unsigned int mOffset; // in bytes, into the props.
+			UniformType mType;
+		} mProp;
 	};
 	UniformType mType = UNSET;
 
@@ -80,16 +133,138 @@ struct UniformValue {
 	UniformValue() { 
 		mType = UNSET; 
 	}
+
+	/*
+	A uniform whose value is read from a member of the props passed to submit(command, &props), like a regl prop.
+	This way a Command can be created once, and only the props, which can be any struct, change between submits.
+	The member must be a float, a std::array of 2 to 4 floats, a 4x4 std::array, or a Texture2D*.
+	Props must be standard layout and default constructible, since the offset of the member is measured on an instance.
+	E.g. '{ "uModelMatrix", UniformValue::prop(&MeshProps::mModelMatrix) }'
+	*/
+	template<typename Props, typename T>
+	static UniformValue prop(T Props::* member) {
+		static_assert(std::is_standard_layout<Props>::value, "the props of a uniform must be standard layout");
+		// created once per Props type, only to measure the offset of the member.
+		static const Props instance = Props();
+		UniformValue value;
+		value.mProp.mOffset = (unsigned int)(reinterpret_cast<const char*>(&(instance.*member)) - reinterpret_cast<const char*>(&instance));
+		value.mProp.mType = propType((const T*)nullptr);
+		value.mType = PROP;
+		return value;
+	}
+
+private:
+	static UniformType propType(const float*) { return FLOAT_VEC1; }
+	static UniformType propType(const std::array<float, 1>*) { return FLOAT_VEC1; }
+	static UniformType propType(const std::array<float, 2>*) { return FLOAT_VEC2; }
+	static UniformType propType(const std::array<float, 3>*) { return FLOAT_VEC3; }
+	static UniformType propType(const std::array<float, 4>*) { return FLOAT_VEC4; }
+	static UniformType propType(const std::array<std::array<float, 4>, 4>*) { return FLOAT_MAT4X4; }
+	static UniformType propType(Texture2D* const*) { return TEXTURE2D; }
 };
 
 struct Uniform {
-	std::string mKey;
+	Symbol mKey;
 	UniformValue mValue;
 };
 
+/*
+Sub-allocates the storage of many VertexBuffers and IndexBuffers from a few large GL buffers, the arenas, so that 
+small meshes don't each need a buffer object of their own, see VertexBuffer::pool() and IndexBuffer::pool(). 
+Draws of different meshes in the same arenas bind the same vertex array, and can be merged into multi-draw calls.
+The ranges are handed out by a buddy allocator: an arena is split into blocks whose sizes are powers of two, and 
+a block that is released is merged with its buddy whenever that is free too. 
+The pool has to outlive the buffers allocated from it. In WebGL, index and vertex data may not share a GL buffer,
+so a pool may only be used for one of them there.
+*/
+struct BufferPool {
+	// the smallest block, which is also the alignment of all blocks.
+	static const unsigned int MIN_BLOCK_SIZE = 256;
+
+	struct Allocation {
+		int mArena = -1;
+		unsigned int mBlock = 0; // the offset of the block in the arena.
+		int mOrder = 0; // the block is MIN_BLOCK_SIZE << mOrder bytes.
+		unsigned int mOffset = 0; // the offset of the data, which is after the start of the block if it had to be aligned.
+		unsigned int mSize = 0;
+	};
+
+	struct Arena {
+		unsigned int mBufferObject;
+		unsigned int mSize;
+		// the offsets of the free blocks of each order.
+		std::vector<std::set<unsigned int>> mFreeBlocks;
+	};
+
+	struct Stats {
+		int mNumArenas = 0;
+		int mNumAllocations = 0;
+		size_t mArenaBytes = 0;
+		// the bytes requested by the allocations, and those of the blocks that hold them.
+		size_t mRequestedBytes = 0;
+		size_t mBlockBytes = 0;
+		size_t mFreeBytes = 0;
+		size_t mLargestFreeBlock = 0;
+
+		// the fraction of the arenas that holds data.
+		double utilization() const {
+			return mArenaBytes == 0 ? 0.0 : (double)mRequestedBytes / (double)mArenaBytes;
+		}
+
+		// the fraction of the allocated blocks that is lost to rounding their sizes up to powers of two.
+		double internalFragmentation() const {
+			return mBlockBytes == 0 ? 0.0 : 1.0 - (double)mRequestedBytes / (double)mBlockBytes;
+		}
+
+		// the fraction of the free bytes that are not in the largest free block.
+		double externalFragmentation() const {
+			return mFreeBytes == 0 ? 0.0 : 1.0 - (double)mLargestFreeBlock / (double)mFreeBytes;
+		}
+	};
+
+	// the size of each arena, which is rounded up to a power of two. allocations that are larger get an arena of their own.
+	unsigned int mArenaSize = 16 * 1024 * 1024;
+	std::vector<Arena> mArenas;
+
+	int mNumAllocations = 0;
+	size_t mRequestedBytes = 0;
+	size_t mBlockBytes = 0;
+
+	// what has been allocated from the pool since it was disposed, which WebGL doesn't allow to be both.
+	bool mHoldsVertices = false;
+	bool mHoldsIndices = false;
+
+	BufferPool& arenaSize(unsigned int arenaSize) {
+		mArenaSize = arenaSize;
+		return *this;
+	}
+
+	// a range of 'size' bytes, whose offset is a multiple of 'alignment', which doesn't have to be a power of two.
+	Allocation allocate(unsigned int size, unsigned int alignment);
+	void release(const Allocation& allocation);
+
+	void write(const Allocation& allocation, unsigned int offset, const void* data, unsigned int bytes);
+
+	unsigned int bufferObject(const Allocation& allocation) const {
+		return mArenas[allocation.mArena].mBufferObject;
+	}
+
+	Stats stats() const;
+
+	// deletes the arenas, and the vertex arrays that use them. all the buffers allocated from the pool have to be disposed first.
+	void dispose();
+};
+
+// converts 'value' to a 16 bit float, for the elements of vertex buffers of type 'half'.
+unsigned short halfFloat(float value);
+
+// packs four values in [-1, 1] into the 32 bits of an element of type 'int_10_10_10_2', with x in the lowest bits 
+// and w in the highest two. normals and tangents usually fit in this, and take up a third of the space of three floats.
+unsigned int packInt10_10_10_2(float x, float y, float z, float w);
+
 struct VertexBuffer {
 	// should probably be a pointer to data instead.
-	float* mData = nullptr;
+	const void* mData = nullptr;
 	
 	// gl buffer object.
 	std::pair<unsigned int, bool> mBufferObject = { -1, false };
@@ -97,14 +272,51 @@ struct VertexBuffer {
 	int mNumComponents = -1; // the numer of components of each element in the buffer. 3, means VEC3 for instance
 	int mLength = -1; // the number of elements in the buffer
 
+	// 0 means that the attribute advances once per vertex. N > 0 means that it advances once every N instances.
+	int mDivisor = 0;
+
+	/*
+	the type of the components, which is one of 'float', 'half', 'int8', 'uint8', 'int16', 'uint16', or
+	'int_10_10_10_2' and 'uint_10_10_10_2', which pack four components into 32 bits.
+	*/
+	std::string mType = "float";
+	// whether integer components are mapped to [-1, 1], or [0, 1] if unsigned, instead of being converted as they are.
+	bool mNormalized = false;
+	// the number of bytes from the start of one element to the next, and 0 if the elements are tightly packed.
+	int mStride = 0;
+	// the number of bytes before the first element.
+	int mOffset = 0;
+	// the buffer that the elements are read from, if this buffer has no data of its own, see source().
+	const VertexBuffer* mSource = nullptr;
+
+	// set by finish().
+	unsigned int mGlType = 0;
+	int mElementSize = 0;
+
 	/*
 	either 'static', 'dynamic' or 'stream'
 	*/
 	std::string mUsage = "static";
 
 	std::string mName = "unnnamed"; // can be useful setting for debugging.
+
+	// a streaming buffer holds NUM_REGIONS copies of its data. every frame, update() writes into the next one, 
+	// while the GPU may still be reading the others, and draws read the one in mRegion.
+	static const int NUM_REGIONS = 3;
+	bool mStreaming = false;
+	int mRegion = 0;
+	unsigned long long mRegionFrame = 0; // the frame that mRegion was made the current region in.
+	// the frame in which each region stopped being the current one. it may be read until that frame has finished.
+	std::array<unsigned long long, NUM_REGIONS> mRegionReleased = {};
+	// the persistent mapping of all the regions, if the driver supports it, and nullptr otherwise.
+	unsigned char* mMapped = nullptr;
+
+	// the pool that the data is allocated from, instead of a GL buffer of its own, see pool().
+	BufferPool* mPool = nullptr;
+	BufferPool::Allocation mAllocation;
 	
-	VertexBuffer& data(float* data) {
+	// mLength elements of stride() bytes each, which are floats unless a type() is given.
+	VertexBuffer& data(const void* data) {
 		mData = data;
 		return *this;
 	}
@@ -123,19 +335,112 @@ struct VertexBuffer {
 		mUsage = usage;
 		return *this;
 	}
+
+	// use divisor(1) for buffers that hold per instance data, such as transforms, see Command::instances().
+	VertexBuffer& divisor(int divisor) {
+		mDivisor = divisor;
+		return *this;
+	}
+
+	VertexBuffer& type(const std::string& type) {
+		mType = type;
+		return *this;
+	}
+
+	VertexBuffer& normalized(bool normalized) {
+		mNormalized = normalized;
+		return *this;
+	}
+
+	VertexBuffer& stride(int stride) {
+		mStride = stride;
+		return *this;
+	}
+
+	VertexBuffer& offset(int offset) {
+		mOffset = offset;
+		return *this;
+	}
+
+	/*
+	Reads the elements from the GL buffer of 'source', so that several attributes can be interleaved in one buffer:
+
+		VertexBuffer vertices = VertexBuffer().data(vertexData).length(n).numComponents(3).stride(20).finish();
+		VertexBuffer normals = VertexBuffer().source(&vertices).numComponents(4).type("int_10_10_10_2")
+			.normalized(true).stride(20).offset(12).finish();
+
+	The length is that of the source, and the buffer has to be finished again whenever the source is.
+	Disposing it doesn't dispose the source.
+	*/
+	VertexBuffer& source(const VertexBuffer* source) {
+		mSource = source;
+		return *this;
+	}
+
+	// allocates the data from 'pool', at an offset that is a multiple of the stride. DrawCalls that were compiled
+	// with the buffer have to be compiled again when it is finished again, since it may move in the pool.
+	VertexBuffer& pool(BufferPool* pool) {
+		mPool = pool;
+		return *this;
+	}
 		
 	VertexBuffer& name(const std::string& name) {
 		mName = name;
 		return *this;
 	}
 
+	/*
+	For data that is written every frame with update(), like particles. The writes never wait for the GPU to finish 
+	the draws that read the previous data, unless it is more than NUM_REGIONS - 1 frames behind. 
+	Within a frame, the ranges written by update() must not overlap, since draws may already be reading them.
+	Data is optional, and is the initial contents of the buffer.
+	*/
+	VertexBuffer& streaming(bool streaming) {
+		mStreaming = streaming;
+		return *this;
+	}
+
 	VertexBuffer& finish();
 	void dispose();
+
+	// copies 'bytes' bytes of 'data' into the buffer, starting 'offset' bytes from its start. if the whole buffer of 
+	// a 'dynamic' or 'stream' buffer is written, its old storage is orphaned, so the write doesn't wait for the GPU.
+	void update(int offset, const void* data, int bytes);
+
+	// the number of bytes from the start of one element to the next.
+	int vertexStride() const {
+		return mStride != 0 ? mStride : mElementSize;
+	}
+
+	// the size of the data in bytes, and of one region if the buffer is streaming.
+	int byteSize() const {
+		return vertexStride() * mLength;
+	}
+
+	// where the data that draws read starts in the GL buffer, which is only nonzero for streaming and pooled buffers.
+	int regionOffset() const {
+		if (mSource != nullptr) {
+			return mSource->regionOffset();
+		}
+		if (mPool != nullptr) {
+			return (int)mAllocation.mOffset;
+		}
+		return mStreaming ? mRegion * byteSize() : 0;
+	}
+
+	// the index of the first vertex in the arena of the pool, or -1 if the buffer is not in a pool.
+	int pooledBaseVertex() const {
+		const VertexBuffer* root = mSource != nullptr ? mSource : this;
+		if (root->mPool == nullptr || root->mAllocation.mOffset % vertexStride() != 0) {
+			return -1;
+		}
+		return (int)(root->mAllocation.mOffset / vertexStride());
+	}
 };
 
 struct IndexBuffer {
 	// should probably be a pointer to data instead.
-	unsigned int* mData = nullptr;
+	const void* mData = nullptr;
 
 	std::pair<unsigned int, bool> mBufferObject = { -1, false };
 	int mLength = -1; 
@@ -146,11 +451,54 @@ struct IndexBuffer {
 	*/
 	std::string mUsage = "static";
 
-	IndexBuffer& data(unsigned int* data) {
+	// the type of the data, which is 'uint8', 'uint16' or 'uint32', and is set by data().
+	std::string mType = "uint32";
+
+	// whether 32 bit indices are stored as 16 bits when all of them fit, which halves the memory and bandwidth they take up.
+	// they are never narrowed to 8 bits, since several drivers convert 8 bit indices on the CPU before drawing.
+	bool mNarrow = true;
+
+	// the GL type and size in bytes of the indices in the GL buffer, set by finish().
+	unsigned int mGlType = 0;
+	int mIndexSize = 0;
+
+	// see VertexBuffer::pool().
+	BufferPool* mPool = nullptr;
+	BufferPool::Allocation mAllocation;
+
+	IndexBuffer& data(const unsigned int* data) {
+		mData = data;
+		mType = "uint32";
+		return *this;
+	}
+
+	IndexBuffer& data(const unsigned short* data) {
+		mData = data;
+		mType = "uint16";
+		return *this;
+	}
+
+	IndexBuffer& data(const unsigned char* data) {
 		mData = data;
+		mType = "uint8";
 		return *this;
 	}
 
+	IndexBuffer& narrow(bool narrow) {
+		mNarrow = narrow;
+		return *this;
+	}
+
+	IndexBuffer& pool(BufferPool* pool) {
+		mPool = pool;
+		return *this;
+	}
+
+	// the index of the first index in the GL buffer, which is only nonzero for pooled buffers.
+	int firstIndex() const {
+		return mPool != nullptr ? (int)(mAllocation.mOffset / mIndexSize) : 0;
+	}
+
 	IndexBuffer& length(int length) {
 		mLength = length;
 		return *this;
@@ -253,7 +601,7 @@ struct Texture2D {
 };
 
 struct Attribute {
-	std::string mKey;
+	Symbol mKey;
 	VertexBuffer* mVertexBuffer;
 };
 
@@ -262,6 +610,9 @@ struct Command {
 	std::vector<Attribute> mAttributes;
 	IndexBuffer* mIndices = nullptr;
 	int mCount = -1;
+	int mInstances = -1;
+	int mFirst = -1;
+	int mBaseVertex = -1;
 	
 	// x, y, w, h
 	std::array<int, 4> mViewport = {-1, -1, -1, -1};
@@ -272,8 +623,12 @@ struct Command {
 	// .second specifies whether this value has been actually set. If second==false, treat 'first' as invalid.
 	// since it hasnt been set yet. 
 	std::pair<bool, bool> mDepthTest = { false, false };
+	std::pair<bool, bool> mOrdered = { false, false };
 	std::string mVert = "";
 	std::string mFrag = "";
+	unsigned long long mVertHash = 0;
+	unsigned long long mFragHash = 0;
+	unsigned long long mDefines = 0; // a set of defineBit()s.
 
 	std::string mPrimitive = "triangles";
 	
@@ -290,16 +645,47 @@ struct Command {
 		return *this;
 	}
 
+	// a braced list is assigned directly, without a temporary vector, so a reused Command doesn't allocate.
+	Command& uniforms(std::initializer_list<Uniform> uniforms) {
+		this->mUniforms.assign(uniforms.begin(), uniforms.end());
+		return *this;
+	}
+
 	Command& count(const int count) {
 		this->mCount = count;
 		return *this;
 	}
 
+	// draws 'instances' instances of the primitives with a single instanced draw call.
+	// attributes with a VertexBuffer::divisor() advance per instance instead of per vertex.
+	Command& instances(const int instances) {
+		this->mInstances = instances;
+		return *this;
+	}
+
+	// the first index to draw from the index buffer, or the first vertex if there is no index buffer.
+	// together with count(), this selects a range, so that many meshes can share the same buffers.
+	Command& first(const int first) {
+		this->mFirst = first;
+		return *this;
+	}
+
+	// a value that is added to every index read from the index buffer.
+	Command& baseVertex(const int baseVertex) {
+		this->mBaseVertex = baseVertex;
+		return *this;
+	}
+
 	Command& attributes(const std::vector<Attribute>& attributes) {
 		this->mAttributes = attributes;
 		return *this;
 	}
 
+	Command& attributes(std::initializer_list<Attribute> attributes) {
+		this->mAttributes.assign(attributes.begin(), attributes.end());
+		return *this;
+	}
+
 	Command& indices(IndexBuffer* indices) {
 		this->mIndices = indices;
 		return *this;
@@ -321,13 +707,47 @@ struct Command {
 		return *this;
 	}
 
+	// when recording into a CommandBuffer, ordered draws are executed in submission order
+	// relative to the other draws. use this for draws that depend on what was drawn before them.
+	Command& ordered(bool ordered) {
+		this->mOrdered.first = ordered;
+		this->mOrdered.second = true;
+		return *this;
+	}
+
 	Command& vert(const std::string& vert) {
 		this->mVert = vert;
+		this->mVertHash = shaderHash(vert);
+		return *this;
+	}
+
+	// like above, but a string literal is copied into the existing string instead of a temporary one.
+	Command& vert(const char* vert) {
+		this->mVert.assign(vert);
+		this->mVertHash = shaderHash(this->mVert);
 		return *this;
 	}
 
 	Command& frag(const std::string& frag) {
 		this->mFrag = frag;
+		this->mFragHash = shaderHash(frag);
+		return *this;
+	}
+
+	Command& frag(const char* frag) {
+		this->mFrag.assign(frag);
+		this->mFragHash = shaderHash(this->mFrag);
+		return *this;
+	}
+	
+	// preprocessor defines, like 'SKINNING', that are added to both shaders after the '#version' directive.
+	// each set of defines is a variant of the program, which is compiled the first time it is used, see also precompile().
+	// the defines of all the Commands on the stack are combined, so e.g. 'FOG' can be enabled for a whole scope.
+	Command& defines(const std::vector<std::string>& defines) {
+		this->mDefines = 0;
+		for (const std::string& define : defines) {
+			this->mDefines |= defineBit(define);
+		}
 		return *this;
 	}
 	
@@ -335,68 +755,859 @@ struct Command {
 		this->mPrimitive = primitive;
 		return *this;
 	}
+
+	// sets everything back to the defaults above, but keeps the memory of the vectors and strings.
+	void reset() {
+		mUniforms.clear();
+		mAttributes.clear();
+		mIndices = nullptr;
+		mCount = -1;
+		mInstances = -1;
+		mFirst = -1;
+		mBaseVertex = -1;
+		mViewport = { -1, -1, -1, -1 };
+		mClearColor = { NAN, NAN, NAN, NAN };
+		mClearDepth = NAN;
+		mDepthTest = { false, false };
+		mOrdered = { false, false };
+		mVert.clear();
+		mFrag.clear();
+		mVertHash = 0;
+		mFragHash = 0;
+		mDefines = 0;
+		mPrimitive = "triangles";
+	}
+};
+
+struct reglCppContext;
+
+// the state of a single draw, with everything resolved to GL values.
+struct DrawState {
+	// x, y, w, h
+	std::array<int, 4> mViewport = { -1, -1, -1, -1 };
+
+	// whether this call clears the framebuffer, using mClearColor and mClearDepth.
+	bool mClear = false;
+	std::array<float, 4> mClearColor = { NAN, NAN, NAN, NAN };
+	float mClearDepth = NAN;
+
+	// whether this call draws any primitives. if false, the fields below are invalid.
+	bool mDraw = false;
+	bool mDepthTest = true;
+	unsigned int mProgram = -1;
+	unsigned int mPrimitive = 0; // the GL enum of the primitive type.
+	IndexBuffer* mIndices = nullptr;
+	int mCount = -1;
+	int mInstances = -1; // -1 for a non-instanced draw.
+	int mFirst = 0;
+	int mBaseVertex = 0;
+
+	// whether this draw depends on the draws submitted around it, so that a CommandBuffer may not reorder it.
+	bool mOrdered = false;
+
+	// whether the attributes are bound from the start of their BufferPool arenas, with the first vertex of the mesh
+	// in mBaseVertex, or in mFirst if there are no indices. 
+	bool mPooled = false;
+
+	// the vertex array of the attributes and indices, resolved when the draw is compiled, so that drawing it is only
+	// a glBindVertexArray. it is valid while mVertexArrayGeneration is the vertexArrayGeneration of the context, and
+	// looked up again and updated otherwise, which is why it is mutable. 0 for draws with streaming buffers, whose 
+	// vertex array changes with the region that is written.
+	mutable unsigned int mVertexArray = 0;
+	mutable unsigned long long mVertexArrayGeneration = 0;
+};
+
+/*
+A Command that has been resolved against the context state once, by reglCppContext::compile().
+The program lookup, the uniform and attribute locations, the primitive type and the validation
+are all done at compile time, so draw() only has to issue the GL calls.
+*/
+struct DrawCall : DrawState {
+	struct UniformBinding {
+		int mLocation;
+		UniformValue mValue;
+	};
+
+	struct AttributeBinding {
+		int mLocation;
+		VertexBuffer* mVertexBuffer;
+	};
+
+	// a uniform block of the program. its data, in std140 layout, is the range [mOffset, mOffset + mSize) of mBlockData.
+	struct BlockBinding {
+		unsigned int mBinding;
+		unsigned int mOffset;
+		unsigned int mSize;
+	};
+
+	// a uniform that is a member of the uniform block with index mBlock in mBlocks.
+	struct BlockMember {
+		unsigned int mSymbol;
+		int mBlock;
+		int mOffset;
+		int mMatrixStride;
+	};
+
+	reglCppContext* mContext = nullptr;
+
+	std::vector<UniformBinding> mUniforms;
+	std::vector<AttributeBinding> mAttributes;
+
+	// the uniform blocks of the program, which only programs with a '#version 330' or later shader can have.
+	// their data is laid out at compile time, so drawing only copies it into the uniform ring buffer of the context.
+	std::vector<BlockBinding> mBlocks;
+	std::vector<unsigned char> mBlockData;
+
+	// the block members and the uniform locations of the program, which are used for the uniforms passed to draw().
+	// they belong to the program in the context, so that compiling doesn't copy them. nullptr before compiling a draw.
+	const std::vector<BlockMember>* mBlockMembers = nullptr;
+	const std::vector<int>* mUniformLocations = nullptr;
+
+	// the location of the uniform with the symbol id 'symbol', or -1 if the program doesn't have it.
+	int uniformLocation(unsigned int symbol) const {
+		if (mUniformLocations == nullptr || symbol >= mUniformLocations->size()) {
+			return -1;
+		}
+		return (*mUniformLocations)[symbol];
+	}
+
+	void draw();
+
+	// the dynamic uniforms are set after the uniforms of the compiled command, so they override them.
+	void draw(const std::vector<Uniform>& dynamicUniforms);
+};
+
+/*
+Records draws instead of executing them, see reglCppContext::record().
+When flushed, the draws are sorted by a key made from their framebuffer, program, texture and buffers, 
+so that draws sharing GL state are executed together. Clears and draws with Command::ordered(true) are never
+reordered, and no draw is moved across them. Draws with equal keys keep their submission order.
+Neighbouring draws that only differ in their first(), count() and baseVertex() are then merged into a single
+multi-draw call. Since there is no draw id in GLSL 100, per draw data has to come from the vertex data, 
+and draws with different uniforms are never merged this way.
+*/
+struct CommandBuffer {
+	struct RecordedDraw {
+		unsigned long long mSortKey;
+		unsigned int mSequence;
+
+		DrawState mState;
+
+		// ranges of mUniforms, mAttributes and mBlocks.
+		unsigned int mFirstUniform;
+		unsigned int mNumUniforms;
+		unsigned int mFirstAttribute;
+		unsigned int mNumAttributes;
+		unsigned int mFirstBlock;
+		unsigned int mNumBlocks;
+	};
+
+	reglCppContext* mContext = nullptr;
+
+	std::vector<RecordedDraw> mDraws;
+	std::vector<DrawCall::UniformBinding> mUniforms;
+	std::vector<DrawCall::AttributeBinding> mAttributes;
+
+	// the offsets of the blocks are into mBlockData.
+	std::vector<DrawCall::BlockBinding> mBlocks;
+	std::vector<unsigned char> mBlockData;
+
+	// whether two recorded draws have the same uniform block data.
+	bool sameBlocks(const RecordedDraw& a, const RecordedDraw& b) const;
+
+	void record(const DrawCall& drawCall, const std::vector<Uniform>* dynamicUniforms);
+
+	// records a compiled draw. unlike DrawCall::draw(), this never touches the context or GL,
+	// so it may be called from any thread, as long as each thread has its own CommandBuffer.
+	void draw(const DrawCall& drawCall) {
+		record(drawCall, nullptr);
+	}
+
+	void draw(const DrawCall& drawCall, const std::vector<Uniform>& dynamicUniforms) {
+		record(drawCall, &dynamicUniforms);
+	}
+
+	// appends all the draws recorded in 'other'.
+	void append(const CommandBuffer& other);
+
+	void clear();
+
+	// sorts and executes all the recorded draws, and stops the recording.
+	void flush();
+};
+
+/*
+A linear allocator for data that only lives until the end of the frame, see reglCppContext::frameAllocate().
+Allocating only bumps an offset into the current chunk, and a new chunk is allocated when it is full.
+reset() frees everything at once, and if more than one chunk was used, replaces them with a single chunk
+that is as large as all of them together. so once the frames are of a similar size, it never allocates again.
+*/
+struct FrameArena {
+	struct Chunk {
+		unsigned char* mData;
+		size_t mSize;
+	};
+
+	std::vector<Chunk> mChunks;
+	size_t mOffset = 0; // into the last chunk.
+
+	// the number of bytes allocated since the last reset(), including the padding for alignment.
+	size_t mUsed = 0;
+
+	// the number of chunks allocated from the heap, over the whole lifetime of the arena.
+	int mHeapAllocations = 0;
+
+	FrameArena() {}
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+	~FrameArena();
+
+	// 'alignment' must be a power of two.
+	void* allocate(size_t size, size_t alignment);
+	void reset();
 };
 
 struct reglCppContext {
+public:
+	struct Stats {
+		// number of GL state changes that were actually issued, and those that were skipped
+		// because GL already had the requested value.
+		int mStateCallsIssued = 0;
+		int mStateCallsElided = 0;
+
+		// number of recorded draws that the batching pass merged into instanced draws, see enableBatching().
+		int mDrawsBatched = 0;
+
+		// number of recorded draws that were merged into multi-draw calls when a CommandBuffer was flushed.
+		int mDrawsMultiDrawn = 0;
+
+		// number of uniform blocks written to the uniform ring buffer, and those that were skipped
+		// because the same data was already bound, e.g. per pass data shared by all the draws of a pass.
+		int mBlocksUploaded = 0;
+		int mBlocksReused = 0;
+
+		// number of uniform values uploaded with glUniform*, and those that were skipped
+		// because the program already had the same value.
+		int mUniformsUploaded = 0;
+		int mUniformsElided = 0;
+
+		// number of textures that were bound to a unit, and those that were already bound to one.
+		int mTextureBinds = 0;
+		int mTextureBindsElided = 0;
+
+		// number of vertex array objects created for new combinations of attributes and buffers.
+		int mVertexArraysCreated = 0;
+
+		// number of programs that were loaded from the program binary cache, and those that had to be compiled,
+		// see programBinaryCache(). the time saved is the compile time stored with each binary, minus the time it took to load it.
+		int mProgramBinaryHits = 0;
+		int mProgramBinaryMisses = 0;
+		double mProgramBinaryTimeSaved = 0.0;
+
+		// number of submits that drew with the fallback program, because their own program was still being compiled.
+		int mProgramFallbacks = 0;
+
+		// number of times that a streaming VertexBuffer::update() had to wait for the GPU to finish reading a region.
+		int mStreamingWaits = 0;
+
+		// number of heap allocations made by the frame arena and the pool of frameCommand()s: the chunks of the arena,
+		// new Commands and the growth of the pool, and the uniforms, attributes or shaders of a Command that outgrew
+		// their capacity. it stops increasing once the frames have reached their largest size.
+		int mFrameHeapAllocations = 0;
+
+		// number of bytes allocated from the frame arena in the last frame.
+		size_t mFrameArenaBytes = 0;
+	};
+
 private:
+	friend struct DrawCall;
+	friend struct CommandBuffer;
+	friend struct VertexBuffer;
+	friend struct IndexBuffer;
+	friend struct Texture2D;
+	friend struct BufferPool;
 
+	/*
+	The state that a Command is drawn with, resolved from all the Commands on the stack.
+	It only points into those Commands, so resolving it never copies shader sources or uniform values,
+	and since the same instance is reused between submits, the vectors don't allocate once they have grown.
+	Uniforms and attributes are indexed by symbol id, with the ids that are set listed in mUniformIds and mAttributeIds.
+	*/
 	struct contextState{
 		std::array<float, 4> mClearColor;
 		float mClearDepth;
 
-		std::string mVert;
-		std::string mFrag;
-		std::string mPrimitive;
+		const std::string* mVert;
+		const std::string* mFrag;
+		unsigned long long mVertHash;
+		unsigned long long mFragHash;
+		unsigned long long mDefines;
+		const std::string* mPrimitive;
 		bool mDepthTest;
+		bool mOrdered;
 		
-		std::map<std::string, UniformValue> mUniforms;		
-		std::map<std::string, VertexBuffer*> mAttributes;
-		IndexBuffer* mIndices = nullptr;
+		std::vector<const UniformValue*> mUniforms;
+		std::vector<unsigned int> mUniformIds;
+		// the values of the uniforms that are props, read from the props of their submit(). indexed by symbol id.
+		std::vector<UniformValue> mPropValues;
+		std::vector<VertexBuffer*> mAttributes;
+		std::vector<unsigned int> mAttributeIds;
+		IndexBuffer* mIndices;
 		int mCount;
+		int mInstances;
+		int mFirst;
+		int mBaseVertex;
 		std::array<int, 4> mViewport;
 		
 		contextState(){
+			reset();
+		}
+
+		void reset() {
 			mViewport = { -1, -1, -1, -1 };
 
 			mClearColor = { NAN, NAN, NAN, NAN };
 			mClearDepth = NAN;
 
-			mVert = "";
-			mFrag = "";
-			mPrimitive = "";
-
+			mVert = nullptr;
+			mFrag = nullptr;
+			mVertHash = 0;
+			mFragHash = 0;
+			mDefines = 0;
+			mPrimitive = nullptr;
 
 			mDepthTest = true;
+			mOrdered = false;
+
+			for (unsigned int id : mUniformIds) {
+				mUniforms[id] = nullptr;
+			}
+			mUniformIds.clear();
 
+			for (unsigned int id : mAttributeIds) {
+				mAttributes[id] = nullptr;
+			}
+			mAttributeIds.clear();
+
+			mIndices = nullptr;
 			mCount = -1;
+			mInstances = -1;
+			mFirst = 0;
+			mBaseVertex = 0;
+		}
+
+		// resets the state to 'other', in time proportional to the number of uniforms and attributes that it sets.
+		// 'numSymbols' is the number of symbols that have been interned, which the vectors are grown to.
+		void assign(const contextState& other, size_t numSymbols) {
+			reset();
+
+			// nothing points into the vectors after reset(), so they can be grown.
+			if (mUniforms.size() < numSymbols) {
+				mUniforms.resize(numSymbols, nullptr);
+				mPropValues.resize(numSymbols);
+				mAttributes.resize(numSymbols, nullptr);
+			}
+
+			mClearColor = other.mClearColor;
+			mClearDepth = other.mClearDepth;
+			mVert = other.mVert;
+			mFrag = other.mFrag;
+			mVertHash = other.mVertHash;
+			mFragHash = other.mFragHash;
+			mDefines = other.mDefines;
+			mPrimitive = other.mPrimitive;
+			mDepthTest = other.mDepthTest;
+			mOrdered = other.mOrdered;
+			mIndices = other.mIndices;
+			mCount = other.mCount;
+			mInstances = other.mInstances;
+			mFirst = other.mFirst;
+			mBaseVertex = other.mBaseVertex;
+			mViewport = other.mViewport;
+
+			for (unsigned int id : other.mUniformIds) {
+				mUniformIds.push_back(id);
+				// the props of 'other' are copied, so that this state doesn't point into it.
+				if (other.mUniforms[id] == &other.mPropValues[id]) {
+					mPropValues[id] = other.mPropValues[id];
+					mUniforms[id] = &mPropValues[id];
+				} else {
+					mUniforms[id] = other.mUniforms[id];
+				}
+			}
+
+			for (unsigned int id : other.mAttributeIds) {
+				mAttributeIds.push_back(id);
+				mAttributes[id] = other.mAttributes[id];
+			}
 		}
 	};
 
 	struct ProgramInfo {
 		unsigned int mProgram = -1;
+		unsigned long long mKey = 0;
+		// the hashes of the sources, which mKey is made from.
+		unsigned long long mVertHash = 0;
+		unsigned long long mFragHash = 0;
 
+		// the sources without the defines, which are inserted when the shaders are compiled.
 		std::string mVert = "";
 		std::string mFrag = "";
+		unsigned long long mDefines = 0;
+
+		// the key of the program in the binary cache, made from the sources with their defines, and the driver.
+		// unlike mKey, it doesn't depend on the order that defines were first seen in, so it is the same in every run.
+		unsigned long long mBinaryKey = 0;
+
+		// true from when the program starts compiling until its link status has been checked and it has been reflected, 
+		// which is deferred to its first use, so that the driver can compile many programs in parallel, see precompile().
+		// the shaders are 0 once they have been deleted, or if the program was loaded from the binary cache.
+		bool mPending = false;
+		unsigned int mVertexShader = 0;
+		unsigned int mFragmentShader = 0;
+		double mCompileStart = 0.0;
+
+		struct ActiveVariable {
+			unsigned int mSymbol;
+			int mLocation;
+		};
+
+		// all active uniforms and attributes of the program.
+		std::vector<ActiveVariable> mUniforms;
+		std::vector<ActiveVariable> mAttributes;
+
+		// uniform locations indexed by symbol id. -1 for uniforms that are not active.
+		std::vector<int> mUniformLocations;
+
+		struct UniformBlock {
+			unsigned int mBinding;
+			int mSize;
+		};
+
+		// the uniform blocks, and the members of them, which are not in mUniforms.
+		std::vector<UniformBlock> mBlocks;
+		std::vector<DrawCall::BlockMember> mBlockMembers;
+	};
+	// all the programs, in a deque so that pointers to them stay valid.
+	std::deque<ProgramInfo> programCache;
+	std::map<unsigned int, const ProgramInfo*> programsById;
+
+	// an open addressing hash table from the combined hashes of the shaders to the programs, with linear probing.
+	// a key of 0 marks an empty slot. it is kept at most half full.
+	struct ProgramSlot {
+		unsigned long long mKey;
+		ProgramInfo* mProgram;
+	};
+	std::vector<ProgramSlot> programTable;
+
+	ProgramInfo* findProgram(unsigned long long key);
+	ProgramInfo& createProgram(unsigned long long key, unsigned long long vertHash, unsigned long long fragHash,
+		const std::string& vert, const std::string& frag, unsigned long long defines);
+	void insertProgramSlot(const ProgramSlot& slot);
+
+	// returns the program, and waits for it if it is still being compiled. if 'allowFallback' is true and
+	// a fallback program has been declared, that is returned instead of waiting.
+	const ProgramInfo& fetchProgram(
+		unsigned long long vertHash, unsigned long long fragHash, const std::string& vert, const std::string& frag, 
+		unsigned long long defines, bool allowFallback);
+
+	// empty if the program binary cache is disabled.
+	std::string programBinaryDirectory;
+	unsigned long long driverHash = 0;
+
+	std::string programBinaryPath(const ProgramInfo& programInfo) const;
+	void storeProgramBinary(const ProgramInfo& programInfo);
+
+	// beginProgram() loads the program from the binary cache, or starts compiling and linking it, without waiting.
+	// endProgram() waits for that to finish, adds the program to the binary cache and reflects it.
+	void beginProgram(ProgramInfo& programInfo);
+	void endProgram(ProgramInfo& programInfo);
+
+	// whether endProgram() would not have to wait. always true without KHR_parallel_shader_compile.
+	bool programCompleted(const ProgramInfo& programInfo);
+
+	// .first is whether KHR_parallel_shader_compile is supported, .second whether that has been checked.
+	std::pair<bool, bool> parallelShaderCompile = { false, false };
+	void enableParallelShaderCompile();
+
+	// drawn instead of programs that are still being compiled, see fallbackProgram().
+	const ProgramInfo* fallback = nullptr;
+
+	void reflectProgram(ProgramInfo& programInfo);
+
+	// a variant of a program where some of the uniforms of the vertex shader have been 
+	// turned into per instance attributes. used by the batching pass.
+	struct InstancedProgram {
+		// false if the vertex shader could not be rewritten, in which case the draws are not batched.
+		bool mValid = false;
+		ProgramInfo mInfo;
+	};
+	// keyed by the original program, and the symbols of the uniforms that became attributes.
+	std::map<std::pair<unsigned int, std::vector<unsigned int>>, InstancedProgram> instancedPrograms;
+	// reused for the lookups, so that finding a program that exists doesn't allocate.
+	std::pair<unsigned int, std::vector<unsigned int>> instancedProgramKey;
+
+	const InstancedProgram& fetchInstancedProgram(const ProgramInfo& programInfo, const std::vector<unsigned int>& symbols);
+
+	// state of the batching pass. the vectors are reused between batches.
+	std::vector<unsigned int> batchedUniforms;
+	std::pair<unsigned int, bool> batchBuffer = { -1, false };
+	std::vector<float> batchData;
+	std::vector<unsigned int> batchSymbols;
+	std::vector<int> batchLocations;
+	std::vector<int> batchSizes;
+	std::vector<int> batchOffsets;
+	std::vector<DrawCall::UniformBinding> batchUniformBindings;
+	std::vector<DrawCall::AttributeBinding> batchAttributeBindings;
+
+	// executes the run of mergeable draws starting at 'begin' as a single instanced draw.
+	// returns the number of draws that were executed, which is 0 if the draw at 'begin' could not be batched.
+	size_t executeBatch(const CommandBuffer& buffer, size_t begin);
+
+	// executes the run of draws starting at 'begin' that only differ in their ranges as a single multi-draw call.
+	// returns the number of draws that were executed, which is 0 if there was nothing to merge.
+	size_t executeMultiDraw(const CommandBuffer& buffer, size_t begin);
+
+	std::vector<int> multiDrawFirsts;
+	std::vector<int> multiDrawCounts;
+	std::vector<int> multiDrawBaseVertices;
+	std::vector<const void*> multiDrawOffsets;
+
+	void transferStack(contextState& stackState, const Command& command, const void* props);
+
+	// the Commands of all the scopes entered with submit(command, fn), and their props. each of them only
+	// stores what it changes, which is applied to the state of the scope below it when the scope is entered.
+	struct StackEntry {
+		const Command* mCommand;
+		const void* mProps;
+	};
+	std::vector<StackEntry> stateStack;
+
+	// resolvedStates[i] is the state resolved from the first i entries of stateStack, so resolvedStates[0] is the default state.
+	// the states of popped scopes are kept, so that their vectors are reused. a deque, so that they are never moved.
+	std::deque<contextState> resolvedStates;
+
+	// reused by submit(), so that submitting doesn't allocate.
+	contextState scratchState;
+	DrawCall scratchDrawCall;
+
+	void resolveState(const Command& command, const void* props, contextState& state);
+
+	// mirror of the current GL state, so that redundant state changes can be skipped.
+	// .first contains the value GL currently has. .second specifies whether it is known. 
+	// if .second==false, the next state change is always issued.
+	struct GlState {
+		std::pair<std::array<int, 4>, bool> mViewport = { {}, false };
+		std::pair<std::array<float, 4>, bool> mClearColor = { {}, false };
+		std::pair<float, bool> mClearDepth = { 0.0f, false };
+
+		std::pair<bool, bool> mDepthTest = { false, false };
+		std::pair<bool, bool> mDepthMask = { false, false };
+		std::pair<bool, bool> mBlend = { false, false };
+		std::pair<std::array<bool, 4>, bool> mColorMask = { {}, false };
+		std::pair<bool, bool> mCullFace = { false, false };
+		std::pair<unsigned int, bool> mFrontFace = { 0, false };
+		std::pair<unsigned int, bool> mFramebuffer = { 0, false };
+		std::pair<unsigned int, bool> mDepthFunc = { 0, false };
+		std::pair<unsigned int, bool> mProgram = { 0, false };
+		std::pair<unsigned int, bool> mVertexArray = { 0, false };
+		std::pair<unsigned int, bool> mActiveTexture = { 0, false };
+	};
+	GlState glState;
+
+	// the uniform values last uploaded to each program, indexed by program and then by location, so that 
+	// values the program already has are not uploaded again. UNSET for the locations whose value is unknown.
+	// currentUploadedUniforms are those of the program in glState.mProgram.
+	struct UploadedUniforms {
+		std::vector<UniformValue> mValues;
+		// the unit that each sampler points at, or -1.
+		std::vector<int> mUnits;
+	};
+	std::map<unsigned int, UploadedUniforms> uploadedUniforms;
+	UploadedUniforms* currentUploadedUniforms = nullptr;
+
+	// the texture bound to each unit, which is 0 if unknown, and when it was last used.
+	// textures stay on their units between draws, and new ones replace the least recently used ones.
+	struct TextureUnit {
+		unsigned int mTexture = 0;
+		unsigned long long mLastUse = 0;
+	};
+	std::vector<TextureUnit> textureUnits;
+	unsigned long long textureClock = 0;
+	// the units used after this are taken by the textures of the current draw.
+	unsigned long long drawTextureClock = 0;
+
+	// binds the texture to a unit, preferably 'preferredUnit', unless it is already bound to one, and returns the unit.
+	int bindTexture(const Texture2D* texture, int preferredUnit);
+
+	// forgets the units that the texture is bound to, and the texture of the active unit, when a texture is finished or disposed.
+	void releaseTexture(unsigned int textureObject);
+
+	Stats stats;
+
+	void compileState(const contextState& state, DrawCall& drawCall, bool allowFallback);
+
+	// the symbols of the uniform block names, indexed by binding point. a block has the same binding point 
+	// in all programs, so that data shared between programs stays bound when switching programs.
+	std::vector<unsigned int> blockBindings;
+	unsigned int fetchBlockBinding(unsigned int symbol);
+
+	// the data of all uniform blocks is streamed into this buffer. when it is full, it is orphaned and 
+	// written from the start again, so the writes never have to wait for the GPU.
+	std::pair<unsigned int, bool> uniformRing = { -1, false };
+	unsigned int uniformRingOffset = 0;
+	int uniformRingAlignment = 1;
+
+	// the data last bound to each binding point, so that unchanged blocks are not uploaded again. empty if unknown.
+	std::vector<std::vector<unsigned char>> boundBlocks;
 
-		std::map<std::string, unsigned int> mUniforms;
-		std::map<std::string, int> mAttributes;
+	// the block data of a DrawCall with dynamic uniforms.
+	std::vector<unsigned char> blockScratch;
+
+	void uploadBlocks(const DrawCall::BlockBinding* blocks, size_t numBlocks, const unsigned char* blockData);
+
+	// the command buffer that draws are recorded into, or nullptr when draws are executed immediately.
+	CommandBuffer* recordingBuffer = nullptr;
+	CommandBuffer commandBuffer;
+
+	// one per thread, see recorder().
+	std::vector<CommandBuffer> recorders;
+
+	// the index of the current frame, which is incremented by frame(). 0 before the first frame.
+	unsigned long long frameIndex = 0;
+
+	// while there are streaming vertex buffers, a fence is inserted at the end of every frame, and the ones of the 
+	// last NUM_REGIONS frames are kept. a fence being signaled means that all the frames up to it have finished.
+	struct FrameFence {
+		void* mSync = nullptr;
+		unsigned long long mFrame = 0;
 	};
-	std::map<std::string, ProgramInfo> programCache;
+	std::array<FrameFence, VertexBuffer::NUM_REGIONS> frameFences;
+	int numStreamingBuffers = 0;
+
+	// waits until the GPU has finished the frame 'frame'.
+	void waitForFrame(unsigned long long frame);
+
+	// glBufferStorage of GL 4.4 or ARB_buffer_storage, for persistently mapped streaming buffers.
+	// .first is nullptr if it is not supported, and .second is whether it has been looked up.
+	std::pair<void*, bool> bufferStorage = { nullptr, false };
+	void* fetchBufferStorage();
+
+	// reset at the start of every frame, see frameAllocate() and frameCommand().
+	FrameArena frameArena;
+	int frameArenaHeapAllocations = 0; // FrameArena::mHeapAllocations when the stats were last updated.
+
+	// the Commands are allocated one by one, so that growing the pool doesn't move them.
+	// mCapacities are those of the containers of the Command when it was handed out, to detect that they grew.
+	struct FrameCommand {
+		Command mCommand;
+		std::array<size_t, 5> mCapacities;
+	};
+	std::vector<std::unique_ptr<FrameCommand>> frameCommands;
+	size_t numFrameCommands = 0;
+	// adds the heap allocations of the frame arena and the frameCommand()s since the last call to the stats.
+	void countFrameHeapAllocations();
+
+	void executeDrawCall(const DrawCall& drawCall, const std::vector<Uniform>* dynamicUniforms);
+
+	// executing a draw is split in three, so that the uniforms can come from a DrawCall or a CommandBuffer.
+	// applyDrawState() returns false if there is nothing to draw after the clear.
+	bool applyDrawState(const DrawState& state);
+	void uploadUniforms(const DrawCall::UniformBinding* uniforms, size_t numUniforms);
+	void uploadUniform(int location, const UniformValue& value);
+	void drawPrimitives(const DrawState& state, const DrawCall::AttributeBinding* attributes, size_t numAttributes);
+	void drawBoundPrimitives(const DrawState& state);
+
+	// a vertex array object for every combination of index buffer and attribute locations, buffers, regions and formats 
+	// that has been drawn, so that switching between meshes is a single glBindVertexArray.
+	std::map<std::vector<unsigned int>, unsigned int> vertexArrays;
+	std::vector<unsigned int> vertexArrayKey;
 
-	ProgramInfo fetchProgram(const std::string& vert, const std::string& frag);
+	// incremented whenever vertex arrays are deleted, which invalidates DrawState::mVertexArray.
+	unsigned long long vertexArrayGeneration = 1;
 
-	void transferStack(contextState& stackState, const Command& command);
+	// the vertex array of the attributes and indices, which is created the first time, which also binds it.
+	// if 'pooled' is true, the attributes are bound from the start of their pool arenas, see DrawState::mPooled.
+	unsigned int fetchVertexArray(const DrawCall::AttributeBinding* attributes, size_t numAttributes, const IndexBuffer* indices, bool pooled = false);
 
-	std::stack<contextState> stateStack;
+	void bindVertexArray(unsigned int vertexArray);
 
-	void submitWithContextState(contextState state);
+	void bindVertexArray(const DrawCall::AttributeBinding* attributes, size_t numAttributes, const IndexBuffer* indices, bool pooled = false) {
+		bindVertexArray(fetchVertexArray(attributes, numAttributes, indices, pooled));
+	}
+
+	// binds the vertex array of a draw, using the one resolved by compileState() while it is still valid.
+	void bindVertexArray(const DrawState& state, const DrawCall::AttributeBinding* attributes, size_t numAttributes);
+
+	// deletes the vertex arrays that use the GL buffer 'bufferObject', when it is disposed or finished again.
+	void releaseVertexArrays(unsigned int bufferObject);
+
+	// the two halves of frame(), which is a template so that the body can be inlined into it.
+	void beginFrame();
+	void endFrame();
+
+	void pushScope(const Command& command, const void* props);
+	void popScope();
 
 public:
-	void frame(const std::function<void()>& fn);
+	// at the end of the frame, the draws in all the recorders are merged, sorted and executed.
+	// 'fn' is called directly, so unlike a std::function, a capturing lambda is never copied to the heap.
+	template<typename Fn>
+	void frame(Fn&& fn) {
+		beginFrame();
+		fn();
+		endFrame();
+	}
 
 	//void submit(const Pass& pass);
 	void submit(const Command& command);
-	void submit(const Command& command, const std::function<void()>& fn);
+
+	// 'props' is the struct that the UniformValue::prop() uniforms of the command are read from. it is only read
+	// during the call, so it can be a local variable. a scope's props are used by the props of its own Command.
+	void submit(const Command& command, const void* props);
+
+	// the scope overloads only accept callables, so that 'submit(command, &props)' still picks the one above.
+	template<typename Fn, typename = decltype(std::declval<Fn&>()())>
+	void submit(const Command& command, Fn&& fn) {
+		submit(command, nullptr, fn);
+	}
+
+	template<typename Fn, typename = decltype(std::declval<Fn&>()())>
+	void submit(const Command& command, const void* props, Fn&& fn) {
+		// the command and the props outlive fn(), so the stack can simply point to them.
+		pushScope(command, props);
+		fn();
+		popScope();
+	}
+
+	/*
+	The Command of a scope that lasts until the returned object is destroyed, as an alternative to submit(command, fn):
+
+		{
+			auto scope = context.scope(baseCmd);
+			context.submit(cubeCmd);
+		}
+
+	Scopes must be destroyed in the reverse order of their creation, which is what happens with local variables.
+	*/
+	class Scope {
+	public:
+		Scope(Scope&& other) : mContext(other.mContext) {
+			other.mContext = nullptr;
+		}
+		~Scope() {
+			if (mContext != nullptr) {
+				mContext->popScope();
+			}
+		}
+
+	private:
+		friend struct reglCppContext;
+
+		Scope(reglCppContext* context) : mContext(context) {}
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+		reglCppContext* mContext;
+	};
+
+	Scope scope(const Command& command, const void* props = nullptr) {
+		pushScope(command, props);
+		return Scope(this);
+	}
+
+	/*
+	Allocates 'count' default constructed T from the frame arena. the memory is valid until the start of the next frame(),
+	and is never freed separately, so T may not have a destructor. use this for per frame data, like the props of submit():
+
+		CubeProps* props = context.frameAllocate<CubeProps>();
+	*/
+	template<typename T>
+	T* frameAllocate(size_t count = 1) {
+		static_assert(std::is_trivially_destructible<T>::value, "the destructors of frame allocations are never called");
+		T* data = (T*)frameArena.allocate(sizeof(T) * count, alignof(T));
+		for (size_t i = 0; i < count; ++i) {
+			new (data + i) T();
+		}
+		return data;
+	}
+
+	// an empty Command that is valid until the start of the next frame(). the Commands are reused between frames,
+	// and keep the memory of their uniforms, attributes and shaders, so building them each frame doesn't allocate.
+	Command& frameCommand();
+
+	// resolves 'command' against the current state of the stack, so it can be drawn many times with DrawCall::draw().
+	DrawCall compile(const Command& command);
+
+	// starts recording all submitted draws into a command buffer, instead of executing them.
+	// they are executed when CommandBuffer::flush() is called.
+	CommandBuffer& record();
+
+	/*
+	Enables the batching pass of CommandBuffer::flush(). Runs of recorded draws that use the same program,
+	attributes and indices, and whose uniforms only differ in the uniforms listed here, are merged into a single 
+	instanced draw. To do that, the declarations of those uniforms in the vertex shader are rewritten from
+	'uniform' to 'attribute', and their values are uploaded as per instance data. Only float, vec and mat4 
+	uniforms that the fragment shader doesn't use can be batched. E.g. 'context.enableBatching({ "uModelMatrix" });'
+	*/
+	void enableBatching(const std::vector<Symbol>& instancedUniforms);
+	void disableBatching();
+
+	/*
+	Stores the binaries of all the programs that are linked in 'directory', which must exist, and loads them from there
+	instead of compiling them the next time. The binaries are keyed by the hashes of the shaders and of the GL vendor,
+	renderer and version, and binaries that are stale or rejected by the driver are simply compiled again. 
+	Must be called after GL has been initialized, and only affects the programs created after it. See Stats for the hits and misses.
+	*/
+	void programBinaryCache(const std::string& directory);
+
+	/*
+	Starts compiling and linking all the programs made from the given vertex and fragment shaders, without waiting 
+	for any of them, so that the driver can compile them in the background, e.g. during a loading screen. 
+	With KHR_parallel_shader_compile it uses as many threads as it likes. A program is only waited for when it is first
+	used, or when programsReady() finds that it has completed. E.g. 'context.precompile({ { vert, frag }, { vert, frag2 } });'
+	*/
+	void precompile(const std::vector<std::pair<std::string, std::string>>& programs);
+
+	// precompiles every program with every set of defines in 'variants', see Command::defines().
+	// E.g. 'context.precompile({ { vert, frag } }, { {}, { "SKINNING" }, { "SKINNING", "FOG" } });'
+	void precompile(const std::vector<std::pair<std::string, std::string>>& programs, const std::vector<std::vector<std::string>>& variants);
+
+	// whether all the precompiled programs have completed, so that using them will not wait.
+	bool programsReady();
+
+	/*
+	Declares a program that submit() draws with while the program of the Command is still being compiled, 
+	so that first use never stalls the frame. This needs KHR_parallel_shader_compile, without which a submit 
+	waits for its program. The fallback must only use attributes and uniforms that all the Commands provide.
+	Programs compiled with compile() are always waited for, since a DrawCall keeps its program.
+	*/
+	void fallbackProgram(const std::string& vert, const std::string& frag);
+
+	// creates one recorder per thread that records draws, e.g. JobSystem::numThreads() of them.
+	// must be called on the GL thread, before any recording happens.
+	void createRecorders(int numThreads);
+
+	// the recorder of the thread with index 'threadIndex'. worker threads can record compiled DrawCalls 
+	// into their own recorder with CommandBuffer::draw() without any locking, and the draws are executed on the
+	// GL thread at the end of frame(). draws from different recorders are only ordered by their sort key, 
+	// so Command::ordered() only keeps the order within a single recorder.
+	// the names of the dynamic uniforms should be interned into Symbols before the work is handed to the workers,
+	// since the first time a thread interns a name it has to lock the symbol table.
+	CommandBuffer& recorder(int threadIndex) {
+		return recorders[threadIndex];
+	}
+
+	// forget everything known about the current GL state. call this after changing GL state outside of the context.
+	void invalidateState();
+
+	const Stats& getStats() const {
+		return stats;
+	}
+
+	void resetStats() {
+		stats = Stats();
+	}
 	
 	void dispose();
 };